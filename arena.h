@@ -0,0 +1,77 @@
+#ifndef CALCULATOR_ARENA_H
+#define CALCULATOR_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+#include <vector>
+
+#define ARENA_CHUNK_SIZE (64 * 1024)
+
+/* Bump allocator for parse trees. Nodes are placed one after another in large chunks, in the order the parser
+ * creates them, and are never destroyed individually: reset() releases a whole tree at once and keeps the
+ * chunks for the next expression, so a warm arena parses without touching malloc at all.
+ */
+class Arena {
+public:
+    explicit Arena(size_t chunkSize = ARENA_CHUNK_SIZE) : chunkSize(chunkSize) {
+        addChunk(chunkSize);
+    }
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+    Arena(Arena&&) noexcept = default;
+    Arena& operator=(Arena&&) noexcept = default;
+
+    void* allocate(size_t size, size_t align) {
+        size_t p = (offset + align - 1) & ~(align - 1);
+        if (p + size <= chunks[current].size) {
+            offset = p + size;
+            return chunks[current].data.get() + p;
+        }
+        return allocateSlow(size, align);
+    }
+
+    // only for types that need no destructor call, such as TreeNode subclasses
+    template<class T, class... Args>
+    T* make(Args&&... args) {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    void reset() {
+        current = 0;
+        offset = 0;
+    }
+
+    // number of chunks obtained from the heap over the arena's lifetime
+    [[nodiscard]] size_t chunkAllocations() const {
+        return chunks.size();
+    }
+
+private:
+    struct Chunk {
+        std::unique_ptr<std::byte[]> data;
+        size_t size;
+    };
+
+    std::vector<Chunk> chunks;
+    size_t chunkSize;
+    size_t current = 0;
+    size_t offset = 0;
+
+    void addChunk(size_t size) {
+        chunks.push_back({std::unique_ptr<std::byte[]>(new std::byte[size]), size});
+    }
+
+    void* allocateSlow(size_t size, size_t align) {
+        // move to the next kept chunk that is big enough, or grow by one
+        while (++current < chunks.size() && chunks[current].size < size + align) {}
+        if (current == chunks.size()) {
+            addChunk(size + align > chunkSize ? size + align : chunkSize);
+        }
+        offset = 0;
+        return allocate(size, align);
+    }
+};
+
+#endif //CALCULATOR_ARENA_H
@@ -0,0 +1,391 @@
+#ifndef CALCULATOR_BATCH_H
+#define CALCULATOR_BATCH_H
+
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "parser.h"
+#include "cache.h"
+#include "mapped.h"
+
+#define BATCH_BUFFER_SIZE (1 << 20)
+#define PARALLEL_CHUNK_SIZE (256 * 1024)
+#define PARALLEL_CHUNKS_PER_WORKER 4 // chunks read ahead of the writer, per worker
+#define BATCH_MAX_SYMBOLS (1 << 16) // a parser forgets its identifiers past this many, so --serve stays bounded
+
+/* Per-thread state for evaluating newline-delimited expressions: one parser and its variable array, plus an
+ * optional ExpressionCache for inputs that repeat the same formulas.
+ */
+class LineEvaluator {
+public:
+    explicit LineEvaluator(size_t cacheCapacity = 0) {
+        if (cacheCapacity > 0) {
+            cache = std::make_unique<ExpressionCache>(cacheCapacity);
+        }
+    }
+
+    // appends the result of the expression in [begin, end) to out, or the reason it is invalid;
+    // unbound identifiers are 0
+    void evalLine(const char* begin, const char* end, std::string& out) {
+        if (parser.symbols().size() > BATCH_MAX_SYMBOLS) { // unbound identifiers are all 0, any slot will do
+            parser.symbols().clear();
+        }
+        if (cache != nullptr) {
+            const Program* program = cache->get(begin, end);
+            if (program == nullptr) { // the cache keys drop blanks, so the offset comes from the line itself
+                parser.parse(begin, end);
+                appendError(parser.error(), out);
+                return;
+            }
+            vars.resize(cache->symbols().size());
+            appendResult(program->run(vars.data()), out);
+            return;
+        }
+        TreeNode* tree = parser.parse(begin, end);
+        if (tree == nullptr) {
+            appendError(parser.error(), out);
+            return;
+        }
+        vars.resize(parser.symbols().size());
+        appendResult(tree->eval(vars.data()), out);
+    }
+
+    // evaluates every line in [begin, end); the last line need not end with '\n'
+    void evalLines(const char* begin, const char* end, std::string& out) {
+        while (begin < end) {
+            auto* nl = (const char*) memchr(begin, '\n', end - begin);
+            if (nl == nullptr) {
+                nl = end;
+            }
+            evalLine(begin, nl, out);
+            begin = nl + 1;
+        }
+    }
+
+private:
+    Parser parser;
+    std::unique_ptr<ExpressionCache> cache;
+    std::vector<double> vars;
+
+    // NaN is printed without its sign, which differs between the tree and bytecode (cached) paths
+    static void appendResult(double result, std::string& out) {
+        if (std::isnan(result)) {
+            out.append("nan\n");
+            return;
+        }
+        char num[32];
+        out.append(num, snprintf(num, sizeof num, "%g\n", result));
+    }
+
+    static void appendError(const ParseError& error, std::string& out) {
+        char text[128];
+        int n = snprintf(text, sizeof text, "Invalid input: %s at offset %zu.\n", error.message, error.offset);
+        out.append(text, n);
+    }
+};
+
+template<class Char>
+Char* lastNewline(Char* begin, Char* end) {
+    while (end > begin) {
+        if (*--end == '\n') {
+            return end;
+        }
+    }
+    return nullptr;
+}
+
+// end of the last whole line within the first limit bytes of [begin, end), or of the first line if it is longer
+inline const char* chunkEnd(const char* begin, const char* end, size_t limit) {
+    if ((size_t)(end - begin) <= limit) {
+        return end;
+    }
+    const char* nl = lastNewline(begin, begin + limit);
+    if (nl == nullptr) {
+        nl = (const char*) memchr(begin + limit, '\n', end - begin - limit);
+    }
+    return nl != nullptr ? nl + 1 : end;
+}
+
+/* Serial batch mode: reads newline-delimited expressions from in and writes one result per line, in input order.
+ * Input is consumed in BATCH_BUFFER_SIZE chunks and parsed where it lies, so nothing is copied per expression;
+ * output is collected into a buffer of the same size before being written out.
+ */
+inline int runBatch(FILE* in, FILE* outFile, size_t cacheCapacity = 0) {
+    LineEvaluator evaluator(cacheCapacity);
+    std::vector<char> buf(BATCH_BUFFER_SIZE);
+    std::string out;
+    out.reserve(BATCH_BUFFER_SIZE + 64);
+    size_t pending = 0; // length of the unfinished line kept at the start of buf
+    while (true) {
+        if (pending == buf.size()) { // a single line longer than the buffer
+            buf.resize(buf.size() * 2);
+        }
+        size_t n = fread(buf.data() + pending, 1, buf.size() - pending, in);
+        char* last = buf.data() + pending + n;
+        if (n == 0) {
+            evaluator.evalLines(buf.data(), last, out);
+            break;
+        }
+        char* cut = lastNewline(buf.data() + pending, last);
+        pending += n;
+        if (cut == nullptr) {
+            continue;
+        }
+        evaluator.evalLines(buf.data(), cut + 1, out);
+        if (out.size() >= BATCH_BUFFER_SIZE) {
+            fwrite(out.data(), 1, out.size(), outFile);
+            out.clear();
+        }
+        pending = last - (cut + 1);
+        memmove(buf.data(), cut + 1, pending);
+    }
+    fwrite(out.data(), 1, out.size(), outFile);
+    fflush(outFile);
+    return ferror(in) ? -1 : 0;
+}
+
+// serial batch mode over a whole file, evaluating the lines in place in its mapping
+inline int runBatch(const MappedFile& in, FILE* outFile, size_t cacheCapacity = 0) {
+    LineEvaluator evaluator(cacheCapacity);
+    std::string out;
+    out.reserve(BATCH_BUFFER_SIZE + 64);
+    const char* begin = in.data();
+    const char* end = begin + in.size();
+    while (begin < end) {
+        const char* cut = chunkEnd(begin, end, BATCH_BUFFER_SIZE);
+        evaluator.evalLines(begin, cut, out);
+        fwrite(out.data(), 1, out.size(), outFile);
+        out.clear();
+        begin = cut;
+    }
+    fflush(outFile);
+    return in.readFailed() ? -1 : 0;
+}
+
+struct BatchChunk {
+    size_t seq;
+    std::vector<char> text; // the lines when read from a stream; empty when begin/end view a mapped file
+    const char* begin;
+    const char* end;
+    std::string out;
+};
+
+// one per worker; the owner takes from the front, idle workers steal from the back
+class ChunkDeque {
+public:
+    void push(std::unique_ptr<BatchChunk> chunk) {
+        std::lock_guard<std::mutex> lock(m);
+        chunks.push_back(std::move(chunk));
+    }
+
+    std::unique_ptr<BatchChunk> pop() {
+        std::lock_guard<std::mutex> lock(m);
+        return take(false);
+    }
+
+    std::unique_ptr<BatchChunk> steal() {
+        std::lock_guard<std::mutex> lock(m);
+        return take(true);
+    }
+
+private:
+    std::mutex m;
+    std::deque<std::unique_ptr<BatchChunk>> chunks;
+
+    std::unique_ptr<BatchChunk> take(bool back) {
+        if (chunks.empty()) {
+            return nullptr;
+        }
+        std::unique_ptr<BatchChunk> chunk;
+        if (back) {
+            chunk = std::move(chunks.back());
+            chunks.pop_back();
+        } else {
+            chunk = std::move(chunks.front());
+            chunks.pop_front();
+        }
+        return chunk;
+    }
+};
+
+/* Parallel batch mode with the same output as runBatch(). The calling thread reads the input in chunks of
+ * whole lines and deals them round-robin to per-worker deques; each worker evaluates chunks with its own
+ * LineEvaluator and steals from the others when its deque runs dry, so a chunk of slow expressions only
+ * occupies one worker. A writer thread puts finished chunks back in input order. At most
+ * PARALLEL_CHUNKS_PER_WORKER chunks per worker are in flight, which bounds memory on huge inputs.
+ */
+class ParallelBatch {
+public:
+    explicit ParallelBatch(unsigned threads, size_t cacheCapacity = 0)
+            : queues(threads == 0 ? 1 : threads), cacheCapacity(cacheCapacity) {}
+
+    int run(FILE* in, FILE* outFile) {
+        execute([this, in] { read(in); }, outFile);
+        return ferror(in) ? -1 : 0;
+    }
+
+    // chunks are views into the file, so the reader thread only looks for line breaks
+    int run(const MappedFile& in, FILE* outFile) {
+        execute([this, &in] { split(in.data(), in.data() + in.size()); }, outFile);
+        return in.readFailed() ? -1 : 0;
+    }
+
+private:
+    std::vector<ChunkDeque> queues;
+    size_t cacheCapacity; // per worker
+
+    std::mutex workMutex;
+    std::condition_variable workReady;
+    std::condition_variable slotFree;
+    size_t queued = 0; // chunks in the deques not yet claimed by a worker
+    size_t inFlight = 0; // chunks read but not yet written
+    bool readDone = false;
+    size_t chunkCount = 0;
+
+    std::mutex doneMutex;
+    std::condition_variable doneReady;
+    std::map<size_t, std::unique_ptr<BatchChunk>> done;
+
+    template<class Read>
+    void execute(Read read, FILE* outFile) {
+        std::vector<std::thread> workers;
+        for (size_t i = 0; i < queues.size(); i++) {
+            workers.emplace_back([this, i] { work(i); });
+        }
+        std::thread writer([this, outFile] { write(outFile); });
+
+        read();
+
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        writer.join();
+        fflush(outFile);
+    }
+
+    void read(FILE* in) {
+        std::vector<char> carry; // unfinished line from the previous read
+        size_t seq = 0;
+        while (true) {
+            auto chunk = std::make_unique<BatchChunk>();
+            size_t have = carry.size();
+            chunk->text = std::move(carry);
+            chunk->text.resize(have + PARALLEL_CHUNK_SIZE);
+            size_t n = fread(chunk->text.data() + have, 1, PARALLEL_CHUNK_SIZE, in);
+            if (n == 0) {
+                if (have > 0) {
+                    chunk->text.resize(have);
+                    submit(std::move(chunk), seq++);
+                }
+                break;
+            }
+            char* begin = chunk->text.data();
+            char* cut = lastNewline(begin + have, begin + have + n);
+            if (cut == nullptr) { // no complete line yet, keep reading
+                chunk->text.resize(have + n);
+                carry = std::move(chunk->text);
+                continue;
+            }
+            carry.assign(cut + 1, begin + have + n);
+            chunk->text.resize(cut + 1 - begin);
+            submit(std::move(chunk), seq++);
+        }
+        finishReading(seq);
+    }
+
+    void split(const char* begin, const char* end) {
+        size_t seq = 0;
+        while (begin < end) {
+            auto chunk = std::make_unique<BatchChunk>();
+            const char* cut = chunkEnd(begin, end, PARALLEL_CHUNK_SIZE);
+            chunk->begin = begin;
+            chunk->end = cut;
+            submit(std::move(chunk), seq++);
+            begin = cut;
+        }
+        finishReading(seq);
+    }
+
+    void finishReading(size_t seq) {
+        {
+            std::lock_guard<std::mutex> lock(workMutex);
+            readDone = true;
+            chunkCount = seq;
+            workReady.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(doneMutex); // the writer checks readDone while holding doneMutex
+        doneReady.notify_all();
+    }
+
+    void submit(std::unique_ptr<BatchChunk> chunk, size_t seq) {
+        chunk->seq = seq;
+        if (!chunk->text.empty()) {
+            chunk->begin = chunk->text.data();
+            chunk->end = chunk->text.data() + chunk->text.size();
+        }
+        std::unique_lock<std::mutex> lock(workMutex);
+        slotFree.wait(lock, [this] { return inFlight < queues.size() * PARALLEL_CHUNKS_PER_WORKER; });
+        inFlight++;
+        queues[seq % queues.size()].push(std::move(chunk));
+        queued++;
+        workReady.notify_one();
+    }
+
+    void work(size_t self) {
+        LineEvaluator evaluator(cacheCapacity);
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(workMutex);
+                workReady.wait(lock, [this] { return queued > 0 || readDone; });
+                if (queued == 0) {
+                    return;
+                }
+                queued--; // claims one chunk, which is now guaranteed to be in some deque
+            }
+            std::unique_ptr<BatchChunk> chunk = queues[self].pop();
+            for (size_t i = 1; chunk == nullptr; i++) {
+                chunk = queues[(self + i) % queues.size()].steal();
+            }
+            evaluator.evalLines(chunk->begin, chunk->end, chunk->out);
+            std::lock_guard<std::mutex> lock(doneMutex);
+            done.emplace(chunk->seq, std::move(chunk));
+            doneReady.notify_one();
+        }
+    }
+
+    void write(FILE* outFile) {
+        for (size_t next = 0;; next++) {
+            std::unique_ptr<BatchChunk> chunk;
+            {
+                std::unique_lock<std::mutex> lock(doneMutex);
+                doneReady.wait(lock, [this, next] { return done.count(next) != 0 || finished(next); });
+                if (done.count(next) == 0) {
+                    return;
+                }
+                chunk = std::move(done[next]);
+                done.erase(next);
+            }
+            fwrite(chunk->out.data(), 1, chunk->out.size(), outFile);
+            std::lock_guard<std::mutex> lock(workMutex);
+            inFlight--;
+            slotFree.notify_one();
+        }
+    }
+
+    // true once the reader is done and every chunk before next has been written
+    bool finished(size_t next) {
+        std::lock_guard<std::mutex> lock(workMutex);
+        return readDone && next == chunkCount;
+    }
+};
+
+#endif //CALCULATOR_BATCH_H
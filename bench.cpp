@@ -0,0 +1,533 @@
+/* Microbenchmarks for the lexer, parser and evaluators.
+ *
+ *      calculator_bench [--count N] [--seed S]
+ *
+ * Each corpus is generated from a fixed seed, so runs are comparable between builds. For every corpus this
+ * reports lexer tokens/sec, parses/sec, heap allocations per parse (after warm-up), tree/bytecode/JIT/column
+ * evaluations per second and the latency distribution of a single parse + evaluation. Finally it compares
+ * number literal conversion by scanNumber() with atof(), times a few polynomial expansions, and compares
+ * polynomials evaluated term by term with their Horner form and multipoint evaluation methods, and gradients by
+ * reverse-mode differentiation with central differences.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "parser.h"
+#include "bytecode.h"
+#include "columns.h"
+#include "jit.h"
+#include "number.h"
+#include "poly.h"
+#include "simplify.h"
+#include "multipoint.h"
+#include "gradient.h"
+
+// counts every heap allocation in the process, so allocations per parse can be reported
+static std::atomic<size_t> allocations{0};
+
+// every replaceable form that allocates or frees is replaced, so none of them mixes with the library's
+static void* countedAlloc(size_t size, size_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size = size ? size : 1;
+    void* p = alignment <= alignof(std::max_align_t)
+              ? std::malloc(size) : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void* operator new(size_t size) {
+    return countedAlloc(size, 0);
+}
+
+void* operator new[](size_t size) {
+    return countedAlloc(size, 0);
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+    return countedAlloc(size, (size_t) alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment) {
+    return countedAlloc(size, (size_t) alignment);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    std::free(p);
+}
+
+#define BENCH_MIN_SECONDS 0.2 // each measurement repeats over the corpus until at least this long
+
+using Clock = std::chrono::steady_clock;
+
+class CorpusGenerator {
+public:
+    explicit CorpusGenerator(unsigned seed) : rng(seed) {}
+
+    // sums and products of ~20 small literals and identifiers, no nesting
+    std::string shallow() {
+        std::string s = operand();
+        for (int i = pick(10, 30); i > 0; i--) {
+            s += binaryOp();
+            s += operand();
+        }
+        return s;
+    }
+
+    // a chain of nested parentheses
+    std::string deep() {
+        int depth = pick(100, 300);
+        std::string s;
+        for (int i = 0; i < depth; i++) {
+            s += "(";
+            s += operand();
+            s += binaryOp();
+        }
+        s += operand();
+        s.append(depth, ')');
+        return s;
+    }
+
+    // a balanced tree with a few thousand nodes
+    std::string wide() {
+        return balanced(11);
+    }
+
+    // literals with many digits
+    std::string longNumbers() {
+        std::string s = longNumber();
+        for (int i = pick(10, 20); i > 0; i--) {
+            s += binaryOp();
+            s += longNumber();
+        }
+        return s;
+    }
+
+    // a machine-generated sum of a few hundred KB, with blanks and long identifiers
+    std::string machine() {
+        std::string s = "0";
+        while (s.size() < 200 * 1024) {
+            s += pick(0, 1) ? "  +  " : "  -  ";
+            s += "coefficient" + std::to_string(pick(0, 99)) + " * variable" + std::to_string(pick(0, 99)) + " ^ 2";
+        }
+        return s;
+    }
+
+    // a literal in scientific notation, e.g. 6.02214076e23
+    std::string scientific() {
+        std::string s = std::to_string(pick(1, 9)) + ".";
+        for (int i = pick(1, 15); i > 0; i--) {
+            s += (char)('0' + pick(0, 9));
+        }
+        return s + "e" + std::to_string(pick(-30, 30));
+    }
+
+    // a hundred distinct identifiers
+    std::string manyIdentifiers() {
+        std::string s = "v0";
+        for (int i = 1; i < 100; i++) {
+            s += binaryOp();
+            s += "v" + std::to_string(pick(0, 99));
+        }
+        return s;
+    }
+
+private:
+    std::mt19937 rng;
+
+    int pick(int lo, int hi) {
+        return std::uniform_int_distribution<int>(lo, hi)(rng);
+    }
+
+    std::string operand() {
+        switch (pick(0, 4)) {
+            case 0:
+                return "x";
+            case 1:
+                return "y";
+            case 2:
+                return std::to_string(pick(0, 9)) + "." + std::to_string(pick(0, 99));
+            case 3:
+                return std::to_string(pick(1, 5)) + "!";
+            default:
+                return std::to_string(pick(1, 999));
+        }
+    }
+
+    std::string binaryOp() {
+        static const char ops[] = "+-*/+-*";
+        return std::string(1, ops[pick(0, 6)]);
+    }
+
+    std::string longNumber() {
+        std::string s;
+        for (int i = pick(12, 20); i > 0; i--) {
+            s += (char)('0' + pick(0, 9));
+        }
+        s += '.';
+        for (int i = pick(3, 8); i > 0; i--) {
+            s += (char)('0' + pick(0, 9));
+        }
+        return s;
+    }
+
+    std::string balanced(int depth) {
+        if (depth == 0) {
+            return operand();
+        }
+        return "(" + balanced(depth - 1) + binaryOp() + balanced(depth - 1) + ")";
+    }
+};
+
+struct Corpus {
+    const char* name;
+    std::vector<std::string> expressions;
+};
+
+// calls fn(expression) over the corpus until BENCH_MIN_SECONDS have passed, returns calls per second
+template<class Fn>
+double rate(const Corpus& corpus, Fn fn) {
+    size_t calls = 0;
+    Clock::time_point start = Clock::now();
+    double elapsed;
+    do {
+        for (const std::string& e : corpus.expressions) {
+            fn(e);
+        }
+        calls += corpus.expressions.size();
+        elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+    } while (elapsed < BENCH_MIN_SECONDS);
+    return calls / elapsed;
+}
+
+void runCorpus(const Corpus& corpus) {
+    Parser parser;
+    std::vector<double> vars(256, 1.5);
+    volatile double sink = 0;
+
+    size_t tokens = 0;
+    for (const std::string& e : corpus.expressions) {
+        tokens += parser.countTokens(e.c_str());
+    }
+    double lexRate = rate(corpus, [&](const std::string& e) { parser.countTokens(e.c_str()); });
+    double tokensPerSec = lexRate * tokens / corpus.expressions.size();
+
+    double parseRate = rate(corpus, [&](const std::string& e) { parser.parse(e.c_str()); });
+
+    size_t before = allocations.load();
+    for (const std::string& e : corpus.expressions) {
+        parser.parse(e.c_str());
+    }
+    double allocsPerParse = (double)(allocations.load() - before) / corpus.expressions.size();
+
+    // evaluation rates exclude parsing: every tree is kept in its own parser
+    std::vector<Parser> parsers(corpus.expressions.size());
+    std::vector<TreeNode*> trees;
+    std::vector<Program> programs;
+    for (size_t i = 0; i < corpus.expressions.size(); i++) {
+        trees.push_back(parsers[i].parse(corpus.expressions[i].c_str()));
+        programs.push_back(Compiler::compile(trees.back()));
+    }
+    size_t next = 0;
+    double treeRate = rate(corpus, [&](const std::string&) {
+        sink = trees[next++ % trees.size()]->eval(vars.data());
+    });
+    double vmRate = rate(corpus, [&](const std::string&) {
+        sink = programs[next++ % programs.size()].run(vars.data());
+    });
+    std::vector<JitFunction> jitted;
+    for (TreeNode* tree : trees) {
+        jitted.emplace_back(tree);
+    }
+    double jitRate = rate(corpus, [&](const std::string&) {
+        sink = jitted[next++ % jitted.size()](vars.data());
+    });
+
+    // column evaluation over 4096 rows of every identifier, reported per row
+    const size_t rows = 4096;
+    std::vector<double> column(rows, 1.5), out(rows);
+    std::vector<const double*> columns(256, column.data());
+    std::vector<ColumnEvaluator> evaluators;
+    for (TreeNode* tree : trees) {
+        evaluators.emplace_back(tree);
+    }
+    double columnRate = rate(corpus, [&](const std::string&) {
+        evaluators[next++ % evaluators.size()].eval(columns.data(), rows, out.data());
+    }) * rows;
+    sink = out[0];
+
+    std::vector<double> latencies;
+    for (int round = 0; round < 5; round++) {
+        for (const std::string& e : corpus.expressions) {
+            Clock::time_point t0 = Clock::now();
+            TreeNode* tree = parser.parse(e.c_str());
+            sink = tree->eval(vars.data());
+            latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        return latencies[std::min(latencies.size() - 1, (size_t)(p * latencies.size()))];
+    };
+
+    printf("%-16s %12.3g %12.3g %8.2f %12.3g %12.3g %12.3g %12.3g %9.2f %9.2f %9.2f %9.2f\n", corpus.name,
+           tokensPerSec, parseRate, allocsPerParse, treeRate, vmRate, jitRate, columnRate,
+           percentile(0.5), percentile(0.9), percentile(0.99), percentile(0.999));
+}
+
+// every number literal in the corpora plus as many in scientific notation
+void runNumbers(const std::vector<Corpus>& corpora, CorpusGenerator& gen) {
+    Corpus literals{"literals", {}};
+    for (const Corpus& corpus : corpora) {
+        for (const std::string& e : corpus.expressions) {
+            for (size_t i = 0; i < e.size();) {
+                if (std::isalpha((unsigned char) e[i])) { // digits inside an identifier are not a literal
+                    while (i < e.size() && std::isalnum((unsigned char) e[i])) {
+                        i++;
+                    }
+                    continue;
+                }
+                size_t n = 0;
+                while (i + n < e.size() && ((e[i + n] >= '0' && e[i + n] <= '9') || e[i + n] == '.')) {
+                    n++;
+                }
+                if (n > 0) {
+                    literals.expressions.push_back(e.substr(i, n));
+                }
+                i += n > 0 ? n : 1;
+            }
+        }
+    }
+    for (size_t i = 0, n = literals.expressions.size(); i < n; i++) {
+        literals.expressions.push_back(gen.scientific());
+    }
+    volatile double sink = 0;
+    double atofRate = rate(literals, [&](const std::string& s) { sink = atof(s.c_str()); });
+    double scanRate = rate(literals, [&](const std::string& s) {
+        double v;
+        scanNumber(s.data(), s.data() + s.size(), v);
+        sink = v;
+    });
+    printf("\n%-16s %12s %12s\n%-16s %12.3g %12.3g\n", "number literals", "atof/s", "scanNumber/s", "",
+           atofRate, scanRate);
+}
+
+// milliseconds per expansion of a few products and powers with up to tens of thousands of terms
+void runPolynomials() {
+    const char* inputs[] = {"(x+y+z+1)^30", "(a+b+c+d+e+f+1)^12", "(x+y)^200*(x-y)^200", "(x/2+1/2)^3000"};
+    printf("\n%-24s %12s %12s\n", "expansion", "terms", "ms");
+    for (const char* input : inputs) {
+        Parser parser;
+        TreeNode* tree = parser.parse(input);
+        Expander expander;
+        size_t runs = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            expander.expand(tree);
+            runs++;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < BENCH_MIN_SECONDS);
+        printf("%-24s %12zu %12.3g\n", input, expander.polynomial().size(), elapsed * 1e3 / runs);
+    }
+    // products of two dense univariate polynomials of degree 100000, with integer (NTT) and real (FFT) coefficients
+    std::mt19937 rng(1);
+    for (bool integers : {true, false}) {
+        Polynomial factors[2]{Polynomial(MonomialLayout()), Polynomial(MonomialLayout())};
+        for (Polynomial& factor : factors) {
+            std::string text;
+            for (int i = 0; i <= 100000; i++) {
+                double c = integers ? (double)(rng() % 19) - 9 : std::uniform_real_distribution<double>(-1, 1)(rng);
+                text += (i > 0 ? "+" : "") + std::to_string(c) + "*x^" + std::to_string(i);
+            }
+            Parser parser;
+            Expander expander;
+            expander.expand(parser.parse(text.c_str()));
+            factor = expander.polynomial();
+        }
+        Polynomial product(factors[0].monomials());
+        size_t runs = 0;
+        Clock::time_point start = Clock::now();
+        double elapsed;
+        do {
+            Polynomial::multiply(factors[0], factors[1], product);
+            runs++;
+            elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        } while (elapsed < BENCH_MIN_SECONDS);
+        printf("%-24s %12zu %12.3g\n", integers ? "dense 100k, integers" : "dense 100k, reals", product.size(),
+               elapsed * 1e3 / runs);
+    }
+}
+
+// evaluations per second of polynomials written term by term, as parsed and after Simplifier made them Horner nodes
+void runHorner() {
+    printf("\n%-24s %12s %14s %12s\n", "polynomial", "tree evals/s", "horner evals/s", "column rows/s");
+    std::mt19937 rng(2);
+    for (int degree : {4, 16, 64}) {
+        std::string text;
+        for (int i = degree; i >= 0; i--) {
+            double c = std::uniform_real_distribution<double>(-1, 1)(rng);
+            text += (i < degree ? "+" : "") + std::to_string(c) + "*x^" + std::to_string(i);
+        }
+        Parser parser;
+        TreeNode* tree = parser.parse(text.c_str());
+        Corpus corpus{"", {text}};
+        double x[1] = {0.75};
+        volatile double sink = 0;
+        double treeRate = rate(corpus, [&](const std::string&) { sink = tree->eval(x); });
+        TreeNode* horner = Simplifier(parser.arena()).simplify(tree);
+        double hornerRate = rate(corpus, [&](const std::string&) { sink = horner->eval(x); });
+        std::vector<double> column(4096, 0.75), out(column.size());
+        const double* columns[1] = {column.data()};
+        ColumnEvaluator evaluator(horner);
+        double columnRate = column.size() * rate(corpus, [&](const std::string&) {
+            evaluator.eval(columns, column.size(), out.data());
+        });
+        char name[32];
+        snprintf(name, sizeof name, "degree %d", degree);
+        printf("%-24s %12.3g %14.3g %12.3g\n", name, treeRate, hornerRate, columnRate);
+    }
+}
+
+// milliseconds per multipoint evaluation of a random polynomial; the subproduct tree is only accurate for points close to 0
+void runMultipoint() {
+    printf("\n%-24s %12s %12s\n", "multipoint", "horner ms", "tree ms");
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<double> uniform(-1, 1);
+    for (int degree : {1000, 65535}) {
+        std::string text;
+        for (int i = 0; i <= degree; i++) {
+            text += (i > 0 ? "+" : "") + std::to_string(uniform(rng)) + "*x^" + std::to_string(i);
+        }
+        Parser parser;
+        MultipointEvaluator evaluator;
+        evaluator.prepare(parser.parse(text.c_str()));
+        std::vector<double> xs(degree == 1000 ? 100000 : degree + 1), out(xs.size());
+        for (double& x : xs) {
+            x = uniform(rng) * 0.01;
+        }
+        double ms[2];
+        for (int i = 0; i < 2; i++) {
+            Clock::time_point start = Clock::now();
+            evaluator.eval(xs.data(), xs.size(), out.data(),
+                           i == 0 ? MultipointMethod::Horner : MultipointMethod::SubproductTree);
+            ms[i] = std::chrono::duration<double>(Clock::now() - start).count() * 1e3;
+        }
+        char name[48];
+        snprintf(name, sizeof name, "degree %d, %zu points", degree, xs.size());
+        printf("%-24s %12.3g %12.3g\n", name, ms[0], ms[1]);
+    }
+}
+
+// full gradients per second of an expression in n identifiers: one reverse sweep against 2n evaluations
+void runGradient() {
+    printf("\n%-24s %12s %12s\n", "gradient", "reverse/s", "central/s");
+    for (int n : {4, 16, 64}) {
+        std::string text;
+        for (int i = 0; i < n; i++) {
+            std::string x = "x" + std::to_string(i), y = "x" + std::to_string((i + 1) % n);
+            text += (i > 0 ? "+" : "") + x + "*" + y + "^2/(1+" + x + "^2)";
+        }
+        Parser parser;
+        TreeNode* tree = parser.parse(text.c_str());
+        Corpus corpus{"", {text}};
+        std::vector<double> vars(parser.symbols().size(), 0.5), grad(vars.size());
+        volatile double sink = 0;
+        GradientEvaluator evaluator(tree);
+        double reverseRate = rate(corpus, [&](const std::string&) {
+            sink = evaluator.gradient(vars.data(), grad.data(), grad.size());
+        });
+        double centralRate = rate(corpus, [&](const std::string&) {
+            for (size_t i = 0; i < vars.size(); i++) {
+                double x = vars[i], h = 1e-6;
+                vars[i] = x + h;
+                double up = tree->eval(vars.data());
+                vars[i] = x - h;
+                grad[i] = (up - tree->eval(vars.data())) / (2 * h);
+                vars[i] = x;
+            }
+            sink = grad[0];
+        });
+        char name[32];
+        snprintf(name, sizeof name, "%d identifiers", n);
+        printf("%-24s %12.3g %12.3g\n", name, reverseRate, centralRate);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t count = 2000;
+    unsigned seed = 42;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (std::strcmp(argv[i], "--count") == 0) {
+            count = (size_t) atol(argv[i + 1]);
+        } else if (std::strcmp(argv[i], "--seed") == 0) {
+            seed = (unsigned) atol(argv[i + 1]);
+        }
+    }
+
+    CorpusGenerator gen(seed);
+    std::vector<Corpus> corpora = {{"shallow", {}}, {"deep", {}}, {"wide", {}}, {"long-numbers", {}},
+                                   {"many-identifiers", {}}, {"machine", {}}};
+    for (size_t i = 0; i < count; i++) {
+        corpora[0].expressions.push_back(gen.shallow());
+        corpora[1].expressions.push_back(gen.deep());
+        if (i % 20 == 0) { // wide trees are ~100x bigger than the others
+            corpora[2].expressions.push_back(gen.wide());
+        }
+        corpora[3].expressions.push_back(gen.longNumbers());
+        corpora[4].expressions.push_back(gen.manyIdentifiers());
+        if (i % 200 == 0) { // a few hundred KB each
+            corpora[5].expressions.push_back(gen.machine());
+        }
+    }
+
+    printf("%-16s %12s %12s %8s %12s %12s %12s %12s %9s %9s %9s %9s\n", "corpus", "tokens/s", "parses/s",
+           "allocs", "tree evals/s", "vm evals/s", "jit evals/s", "column rows/s", "p50 us", "p90 us", "p99 us", "p99.9 us");
+    for (const Corpus& corpus : corpora) {
+        runCorpus(corpus);
+    }
+    runNumbers(corpora, gen);
+    runPolynomials();
+    runHorner();
+    runMultipoint();
+    runGradient();
+}
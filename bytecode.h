@@ -0,0 +1,191 @@
+#ifndef CALCULATOR_BYTECODE_H
+#define CALCULATOR_BYTECODE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "tree.h"
+
+/* A parsed tree lowered to postfix order, e.g. 2*(x+1) becomes
+ *      PushConst 2, PushVar x, PushConst 1, Add, Mul
+ * so evaluating it is a single pass over a contiguous array with an explicit value stack.
+ */
+
+enum class OpCode : uint8_t {
+    PushConst, PushVar, Add, Sub, Mul, Div, Pow, Neg, Fact, Horner
+};
+
+struct Instruction {
+    OpCode op;
+    // index into Program::constants for PushConst, variable slot for PushVar, unused otherwise; for Horner, which
+    // replaces the top of the stack by the polynomial at that value, the index of its degree in Program::constants,
+    // followed there by its coefficients
+    uint32_t arg;
+};
+
+#define VM_LOCAL_STACK 64
+
+class Program {
+public:
+    std::vector<Instruction> code;
+    std::vector<double> constants;
+    size_t maxStack = 0;
+
+    [[nodiscard]] double run(const double* vars) const {
+        double local[VM_LOCAL_STACK];
+        std::vector<double> heap;
+        double* stack = local;
+        if (maxStack > VM_LOCAL_STACK) { // only very deep expressions need the heap
+            heap.resize(maxStack);
+            stack = heap.data();
+        }
+        double* top = stack - 1;
+        for (const Instruction& ins : code) {
+            switch (ins.op) {
+                case OpCode::PushConst:
+                    *++top = constants[ins.arg];
+                    break;
+                case OpCode::PushVar:
+                    *++top = vars[ins.arg];
+                    break;
+                case OpCode::Add:
+                    top[-1] += top[0];
+                    top--;
+                    break;
+                case OpCode::Sub:
+                    top[-1] -= top[0];
+                    top--;
+                    break;
+                case OpCode::Mul:
+                    top[-1] *= top[0];
+                    top--;
+                    break;
+                case OpCode::Div:
+                    top[-1] /= top[0];
+                    top--;
+                    break;
+                case OpCode::Pow:
+                    top[-1] = pow(top[-1], top[0]);
+                    top--;
+                    break;
+                case OpCode::Neg:
+                    top[0] = -top[0];
+                    break;
+                case OpCode::Fact:
+                    top[0] = Factorial::fact(top[0]);
+                    break;
+                case OpCode::Horner:
+                    top[0] = hornerKernel()(&constants[ins.arg + 1], (uint32_t)constants[ins.arg], top[0]);
+                    break;
+            }
+        }
+        return *top;
+    }
+};
+
+class Compiler {
+public:
+    static Program compile(const TreeNode* root) {
+        Compiler c;
+        c.emit(root);
+        return std::move(c.program);
+    }
+
+private:
+    Program program;
+    size_t depth = 0;
+
+    void push(OpCode op, uint32_t arg = 0) {
+        program.code.push_back({op, arg});
+        if (op == OpCode::PushConst || op == OpCode::PushVar) {
+            if (++depth > program.maxStack) {
+                program.maxStack = depth;
+            }
+        } else if (op != OpCode::Neg && op != OpCode::Fact && op != OpCode::Horner) { // binary: pop two, push one
+            depth--;
+        }
+    }
+
+    void pushConst(double v) {
+        push(OpCode::PushConst, (uint32_t)program.constants.size());
+        program.constants.push_back(v);
+    }
+
+    // post-order with an explicit stack, so deep trees compile without deep recursion
+    void emit(const TreeNode* root) {
+        struct Frame {
+            const TreeNode* node;
+            bool operandsDone;
+        };
+        WalkStack<Frame> frames;
+        frames.push({root, false});
+        while (!frames.empty()) {
+            Frame f = frames.pop();
+            const TreeNode* node = f.node;
+            switch (node->kind()) {
+                case NodeKind::Add:
+                case NodeKind::Sub:
+                case NodeKind::Mul:
+                case NodeKind::Div:
+                case NodeKind::Caret: {
+                    auto* op = static_cast<const InfixOp*>(node);
+                    if (f.operandsDone) {
+                        push(infixCode(node->kind()));
+                    } else {
+                        frames.push({node, true});
+                        frames.push({op->right, false});
+                        frames.push({op->left, false});
+                    }
+                    break;
+                }
+                case NodeKind::Negate:
+                    if (f.operandsDone) {
+                        push(OpCode::Neg);
+                    } else {
+                        frames.push({node, true});
+                        frames.push({static_cast<const Negate*>(node)->arg, false});
+                    }
+                    break;
+                case NodeKind::Factorial:
+                    if (f.operandsDone) {
+                        push(OpCode::Fact);
+                    } else {
+                        frames.push({node, true});
+                        frames.push({static_cast<const Factorial*>(node)->arg, false});
+                    }
+                    break;
+                case NodeKind::Double:
+                    pushConst(static_cast<const Double*>(node)->val);
+                    break;
+                case NodeKind::Identifier:
+                    push(OpCode::PushVar, static_cast<const Identifier*>(node)->slot);
+                    break;
+                case NodeKind::Horner: {
+                    auto* h = static_cast<const Horner*>(node);
+                    push(OpCode::PushVar, h->slot);
+                    push(OpCode::Horner, (uint32_t)program.constants.size());
+                    program.constants.push_back(h->degree);
+                    program.constants.insert(program.constants.end(), h->coefs, h->coefs + h->degree + 1);
+                    break;
+                }
+            }
+        }
+    }
+
+    static OpCode infixCode(NodeKind kind) {
+        switch (kind) {
+            case NodeKind::Add:
+                return OpCode::Add;
+            case NodeKind::Sub:
+                return OpCode::Sub;
+            case NodeKind::Mul:
+                return OpCode::Mul;
+            case NodeKind::Div:
+                return OpCode::Div;
+            default:
+                return OpCode::Pow;
+        }
+    }
+};
+
+#endif //CALCULATOR_BYTECODE_H
@@ -0,0 +1,118 @@
+#ifndef CALCULATOR_CACHE_H
+#define CALCULATOR_CACHE_H
+
+#include <cstring>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#include "parser.h"
+#include "bytecode.h"
+
+#define CACHE_MAX_SYMBOLS (1 << 16) // past this many identifiers the cache starts over, symbol table included
+
+/* LRU cache of compiled expressions keyed by their source text with blanks removed, so "x + 1" and "x+1" share
+ * an entry (a blank between two letters/digits, or on either side of a sign after e, is kept as one space:
+ * "x y" must not turn into "xy", nor "1e -3" or "1e- 3" into the literal 1e-3).
+ * A hit skips scanning, parsing and compiling entirely; inputs that fail to parse are cached too.
+ * All programs are compiled against the cache's own symbol table, so vars passed to Program::run() must be
+ * indexed by symbols(). Evicting an entry does not free its identifiers, so the symbol table only shrinks when it
+ * outgrows CACHE_MAX_SYMBOLS and the whole cache is emptied. Not thread-safe: use one cache per thread.
+ */
+class ExpressionCache {
+public:
+    explicit ExpressionCache(size_t capacity) : capacity(capacity == 0 ? 1 : capacity) {}
+
+    // the compiled program for input, or nullptr if input is not a valid expression
+    const Program* get(const char* input) {
+        return get(input, input + std::strlen(input));
+    }
+
+    const Program* get(const char* begin, const char* end) {
+        key.clear();
+        bool blank = false;
+        for (const char* p = begin; p != end; p++) {
+            if (*p == ' ' || *p == '\t' || *p == '\r') {
+                blank = true;
+                continue;
+            }
+            if (blank && !key.empty() && ((isWordChar(key.back()) && isWordChar(*p)) || nextToExponentSign(key, *p))) {
+                key.push_back(' ');
+            }
+            blank = false;
+            key.push_back(*p);
+        }
+        auto it = index.find(key);
+        if (it != index.end()) {
+            hitCount++;
+            entries.splice(entries.begin(), entries, it->second); // move to the front, iterators stay valid
+            return it->second->valid ? &it->second->program : nullptr;
+        }
+        missCount++;
+        if (parser.symbols().size() >= CACHE_MAX_SYMBOLS) {
+            index.clear();
+            entries.clear();
+            parser.symbols().clear();
+        } else if (entries.size() == capacity) {
+            index.erase(entries.back().key);
+            entries.pop_back();
+        }
+        entries.emplace_front();
+        Entry& entry = entries.front();
+        entry.key = key;
+        TreeNode* tree = parser.parse(entry.key.c_str());
+        entry.valid = tree != nullptr;
+        if (entry.valid) {
+            entry.program = Compiler::compile(tree);
+        }
+        index.emplace(entry.key, entries.begin());
+        return entry.valid ? &entry.program : nullptr;
+    }
+
+    [[nodiscard]] const SymbolTable& symbols() const {
+        return parser.symbols();
+    }
+
+    [[nodiscard]] size_t hits() const {
+        return hitCount;
+    }
+
+    [[nodiscard]] size_t misses() const {
+        return missCount;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return entries.size();
+    }
+
+private:
+    struct Entry {
+        std::string key;
+        bool valid = false;
+        Program program;
+    };
+
+    size_t capacity;
+    Parser parser;
+    std::list<Entry> entries; // most recently used first
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index; // keys view into Entry::key
+    std::string key; // reused buffer for the normalized input
+    size_t hitCount = 0;
+    size_t missCount = 0;
+
+    static bool isWordChar(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '.';
+    }
+
+    // a blank before c would keep an e, a sign and digits from reading as one number: "1e -3" or "1e- 3"
+    static bool nextToExponentSign(const std::string& key, char c) {
+        auto isE = [](char e) { return e == 'e' || e == 'E'; };
+        auto isSign = [](char s) { return s == '+' || s == '-'; };
+        size_t n = key.size();
+        return (isE(key[n - 1]) && isSign(c))
+               || (n >= 2 && isE(key[n - 2]) && isSign(key[n - 1]) && c >= '0' && c <= '9');
+    }
+};
+
+#endif //CALCULATOR_CACHE_H
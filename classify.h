@@ -0,0 +1,127 @@
+#ifndef CALCULATOR_CLASSIFY_H
+#define CALCULATOR_CLASSIFY_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define CLASSIFY_X86
+#endif
+
+/* Character classes of a whole input as bitmaps: bit i of word w describes byte 64 * w + i. The lexer uses
+ * them to skip a run of blanks or the rest of an identifier with one count-trailing-zeros per 64 bytes instead
+ * of one comparison per byte. Operators and digits need no bitmap: once the start of a token is known, its first
+ * character decides what it is, and numbers are scanned by scanNumber() while they are converted.
+ * Building the bitmaps is a single SIMD pass (AVX2 when the CPU has it, SSE2 otherwise), 64 bytes per step.
+ */
+class CharClasses {
+public:
+    void build(const char* begin, const char* end) {
+        size_t n = end - begin;
+        size_t words = n / 64 + 1; // at least one clear bit past the end, so scans stop there
+        space.assign(words, 0);
+        word.assign(words, 0);
+        size_t full = n / 64;
+        classifyBlocks()(begin, full, space.data(), word.data());
+        for (size_t i = full * 64; i < n; i++) {
+            space[full] |= (uint64_t)isSpace(begin[i]) << (i % 64);
+            word[full] |= (uint64_t)isWordChar(begin[i]) << (i % 64);
+        }
+    }
+
+    // position of the first byte at or after i that is not a blank
+    [[nodiscard]] size_t skipSpace(size_t i) const {
+        return nextClear(space, i);
+    }
+
+    // position of the first byte at or after i that is not a letter or digit
+    [[nodiscard]] size_t skipWord(size_t i) const {
+        return nextClear(word, i);
+    }
+
+private:
+    std::vector<uint64_t> space; // ' ', '\t', '\r'
+    std::vector<uint64_t> word; // letters and digits
+
+    using ClassifyFn = void (*)(const char* p, size_t blocks, uint64_t* space, uint64_t* word);
+
+    static bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    static bool isWordChar(char c) {
+        return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static size_t nextClear(const std::vector<uint64_t>& bits, size_t i) {
+        size_t w = i / 64;
+        uint64_t rest = ~bits[w] >> (i % 64);
+        if (rest != 0) {
+            return i + __builtin_ctzll(rest);
+        }
+        for (w++; ~bits[w] == 0; w++) {} // the last word always has a clear bit
+        return w * 64 + __builtin_ctzll(~bits[w]);
+    }
+
+    static void classifyScalar(const char* p, size_t blocks, uint64_t* space, uint64_t* word) {
+        for (size_t b = 0; b < blocks; b++, p += 64) {
+            uint64_t s = 0, w = 0;
+            for (int i = 0; i < 64; i++) {
+                s |= (uint64_t)isSpace(p[i]) << i;
+                w |= (uint64_t)isWordChar(p[i]) << i;
+            }
+            space[b] = s;
+            word[b] = w;
+        }
+    }
+
+#ifdef CLASSIFY_X86
+    // byte compares are signed, which is fine: every character of interest is below 0x80
+#define CLASSIFY_SIMD(isa, feature, width, vec, loadu, set1, cmpeq, cmpgt, or_, and_, movemask) \
+    __attribute__((target(feature))) static void classify##isa(const char* p, size_t blocks, uint64_t* space, \
+                                                               uint64_t* word) { \
+        const vec blank = set1(' '), tab = set1('\t'), cr = set1('\r'), lower = set1(0x20); \
+        const vec digitLo = set1('0' - 1), digitHi = set1('9' + 1), letterLo = set1('a' - 1), letterHi = set1('z' + 1); \
+        for (size_t b = 0; b < blocks; b++) { \
+            uint64_t s = 0, w = 0; \
+            for (int i = 0; i < 64; i += width, p += width) { \
+                vec c = loadu((const vec*) p); \
+                vec isBlank = or_(cmpeq(c, blank), or_(cmpeq(c, tab), cmpeq(c, cr))); \
+                vec isDigit = and_(cmpgt(c, digitLo), cmpgt(digitHi, c)); \
+                vec folded = or_(c, lower); /* 'A'..'Z' -> 'a'..'z' */ \
+                vec isLetter = and_(cmpgt(folded, letterLo), cmpgt(letterHi, folded)); \
+                s |= (uint64_t)(uint32_t) movemask(isBlank) << i; \
+                w |= (uint64_t)(uint32_t) movemask(or_(isDigit, isLetter)) << i; \
+            } \
+            space[b] = s; \
+            word[b] = w; \
+        } \
+    }
+
+    CLASSIFY_SIMD(Sse2, "sse2", 16, __m128i, _mm_loadu_si128, _mm_set1_epi8, _mm_cmpeq_epi8, _mm_cmpgt_epi8,
+                  _mm_or_si128, _mm_and_si128, _mm_movemask_epi8)
+    CLASSIFY_SIMD(Avx2, "avx2", 32, __m256i, _mm256_loadu_si256, _mm256_set1_epi8, _mm256_cmpeq_epi8,
+                  _mm256_cmpgt_epi8, _mm256_or_si256, _mm256_and_si256, _mm256_movemask_epi8)
+#undef CLASSIFY_SIMD
+#endif
+
+    // picks the widest kernel the running CPU supports, once
+    static ClassifyFn classifyBlocks() {
+        static const ClassifyFn fn = [] {
+#ifdef CLASSIFY_X86
+            if (__builtin_cpu_supports("avx2")) {
+                return &classifyAvx2;
+            }
+            if (__builtin_cpu_supports("sse2")) {
+                return &classifySse2;
+            }
+#endif
+            return &classifyScalar;
+        }();
+        return fn;
+    }
+};
+
+#endif //CALCULATOR_CLASSIFY_H
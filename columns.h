@@ -0,0 +1,313 @@
+#ifndef CALCULATOR_COLUMNS_H
+#define CALCULATOR_COLUMNS_H
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "bytecode.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define COLUMNS_X86
+#endif
+
+/* Column evaluation: one expression over many rows at once. columns[slot] holds the values of the identifier
+ * with that slot for every row. The expression is compiled to bytecode and each instruction is applied to a
+ * whole block of COLUMN_BLOCK rows before moving on to the next, so the arithmetic runs in SIMD kernels
+ * (AVX2 when the CPU has it, SSE2 otherwise) instead of one virtual eval() call per node per row.
+ */
+
+#define COLUMN_BLOCK 512
+#define COLUMN_MIN_POWI (-1) // integer exponents in this range are rounded once, so powi gives exactly pow()
+#define COLUMN_MAX_POWI 2
+
+struct ColumnKernels {
+    void (*add)(double* a, const double* b, size_t n);
+    void (*sub)(double* a, const double* b, size_t n);
+    void (*mul)(double* a, const double* b, size_t n);
+    void (*div)(double* a, const double* b, size_t n);
+    void (*neg)(double* a, size_t n);
+    void (*powi)(double* a, int e, size_t n); // a[i] = a[i]^e by repeated squaring
+    void (*horner)(double* a, const double* c, uint32_t degree, size_t n); // a[i] = c[0] + c[1]*a[i] + ...
+};
+
+#define COLUMN_SCALAR_KERNEL(name, op) \
+    inline void name##Scalar(double* a, const double* b, size_t n) { \
+        for (size_t i = 0; i < n; i++) { \
+            a[i] = a[i] op b[i]; \
+        } \
+    }
+
+COLUMN_SCALAR_KERNEL(add, +)
+COLUMN_SCALAR_KERNEL(sub, -)
+COLUMN_SCALAR_KERNEL(mul, *)
+COLUMN_SCALAR_KERNEL(div, /)
+
+inline void negScalar(double* a, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        a[i] = -a[i];
+    }
+}
+
+inline void powiScalar(double* a, int e, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        double x = a[i], r = 1;
+        for (unsigned k = std::abs(e); k != 0; k >>= 1) {
+            if (k & 1) {
+                r *= x;
+            }
+            x *= x;
+        }
+        a[i] = e < 0 ? 1 / r : r;
+    }
+}
+
+inline void hornerScalar(double* a, const double* c, uint32_t degree, size_t n) {
+    HornerFn f = hornerKernel();
+    for (size_t i = 0; i < n; i++) {
+        a[i] = f(c, degree, a[i]);
+    }
+}
+
+#ifdef COLUMNS_X86
+
+#define COLUMN_SIMD_KERNEL(name, isa, feature, width, loadu, storeu, vop, op) \
+    __attribute__((target(feature))) inline void name##isa(double* a, const double* b, size_t n) { \
+        size_t i = 0; \
+        for (; i + width <= n; i += width) { \
+            storeu(a + i, vop(loadu(a + i), loadu(b + i))); \
+        } \
+        for (; i < n; i++) { \
+            a[i] = a[i] op b[i]; \
+        } \
+    }
+
+COLUMN_SIMD_KERNEL(add, Sse2, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_add_pd, +)
+COLUMN_SIMD_KERNEL(sub, Sse2, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_sub_pd, -)
+COLUMN_SIMD_KERNEL(mul, Sse2, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_mul_pd, *)
+COLUMN_SIMD_KERNEL(div, Sse2, "sse2", 2, _mm_loadu_pd, _mm_storeu_pd, _mm_div_pd, /)
+COLUMN_SIMD_KERNEL(add, Avx2, "avx2", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_add_pd, +)
+COLUMN_SIMD_KERNEL(sub, Avx2, "avx2", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_sub_pd, -)
+COLUMN_SIMD_KERNEL(mul, Avx2, "avx2", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_mul_pd, *)
+COLUMN_SIMD_KERNEL(div, Avx2, "avx2", 4, _mm256_loadu_pd, _mm256_storeu_pd, _mm256_div_pd, /)
+
+__attribute__((target("sse2"))) inline void negSse2(double* a, size_t n) {
+    const __m128d sign = _mm_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        _mm_storeu_pd(a + i, _mm_xor_pd(_mm_loadu_pd(a + i), sign));
+    }
+    negScalar(a + i, n - i);
+}
+
+__attribute__((target("avx2"))) inline void negAvx2(double* a, size_t n) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        _mm256_storeu_pd(a + i, _mm256_xor_pd(_mm256_loadu_pd(a + i), sign));
+    }
+    negScalar(a + i, n - i);
+}
+
+__attribute__((target("sse2"))) inline void powiSse2(double* a, int e, size_t n) {
+    const __m128d one = _mm_set1_pd(1);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d x = _mm_loadu_pd(a + i), r = one;
+        for (unsigned k = std::abs(e); k != 0; k >>= 1) {
+            if (k & 1) {
+                r = _mm_mul_pd(r, x);
+            }
+            x = _mm_mul_pd(x, x);
+        }
+        _mm_storeu_pd(a + i, e < 0 ? _mm_div_pd(one, r) : r);
+    }
+    powiScalar(a + i, e, n - i);
+}
+
+__attribute__((target("avx2"))) inline void powiAvx2(double* a, int e, size_t n) {
+    const __m256d one = _mm256_set1_pd(1);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d x = _mm256_loadu_pd(a + i), r = one;
+        for (unsigned k = std::abs(e); k != 0; k >>= 1) {
+            if (k & 1) {
+                r = _mm256_mul_pd(r, x);
+            }
+            x = _mm256_mul_pd(x, x);
+        }
+        _mm256_storeu_pd(a + i, e < 0 ? _mm256_div_pd(one, r) : r);
+    }
+    powiScalar(a + i, e, n - i);
+}
+
+// HORNER_KERNEL's Estrin branch step for step, so every row gets exactly what Horner::at() returns; 16 rows at a
+// time in four vectors, which overlap where one row's chain of blocks would leave the FMA units waiting
+__attribute__((target("avx2,fma"))) inline void estrinAvx2(const double* c, uint32_t degree, double* a) {
+    __m256d x[4], r[4], x2[4], x4[4], x8[4];
+    for (int j = 0; j < 4; j++) {
+        x[j] = _mm256_loadu_pd(a + 4 * j);
+        r[j] = _mm256_set1_pd(c[degree]);
+    }
+    uint32_t blocks = (degree + 1) / 8;
+    for (uint32_t i = degree; i-- > blocks * 8;) {
+        const __m256d ci = _mm256_set1_pd(c[i]);
+        for (int j = 0; j < 4; j++) {
+            r[j] = _mm256_fmadd_pd(r[j], x[j], ci);
+        }
+    }
+    for (int j = 0; j < 4; j++) {
+        x2[j] = _mm256_mul_pd(x[j], x[j]);
+        x4[j] = _mm256_mul_pd(x2[j], x2[j]);
+        x8[j] = _mm256_mul_pd(x4[j], x4[j]);
+    }
+    bool first = (degree + 1) % 8 == 0;
+    for (uint32_t b = blocks; b-- > 0;) {
+        __m256d p[8];
+        for (int k = 0; k < 8; k++) {
+            p[k] = _mm256_set1_pd(c[8 * b + k]);
+        }
+        for (int j = 0; j < 4; j++) {
+            __m256d q0 = _mm256_fmadd_pd(_mm256_fmadd_pd(p[3], x[j], p[2]), x2[j], _mm256_fmadd_pd(p[1], x[j], p[0]));
+            __m256d q1 = _mm256_fmadd_pd(_mm256_fmadd_pd(p[7], x[j], p[6]), x2[j], _mm256_fmadd_pd(p[5], x[j], p[4]));
+            __m256d block = _mm256_fmadd_pd(q1, x4[j], q0);
+            r[j] = first ? block : _mm256_fmadd_pd(r[j], x8[j], block);
+        }
+        first = false;
+    }
+    for (int j = 0; j < 4; j++) {
+        _mm256_storeu_pd(a + 4 * j, r[j]);
+    }
+}
+
+// Horner's rule down the coefficients for 16 rows at once, whose four independent chains keep the FMA units busy;
+// from HORNER_ESTRIN_MIN on, Estrin's scheme like hornerKernel(), so columns and trees agree to the bit
+__attribute__((target("avx2,fma"))) inline void hornerAvx2(double* a, const double* c, uint32_t degree, size_t n) {
+    size_t i = 0;
+    if (degree >= HORNER_ESTRIN_MIN) {
+        for (; i + 16 <= n; i += 16) {
+            estrinAvx2(c, degree, a + i);
+        }
+        hornerScalar(a + i, c, degree, n - i);
+        return;
+    }
+    const __m256d top = _mm256_set1_pd(c[degree]);
+    for (; i + 16 <= n; i += 16) {
+        __m256d x0 = _mm256_loadu_pd(a + i), x1 = _mm256_loadu_pd(a + i + 4);
+        __m256d x2 = _mm256_loadu_pd(a + i + 8), x3 = _mm256_loadu_pd(a + i + 12);
+        __m256d r0 = top, r1 = top, r2 = top, r3 = top;
+        for (uint32_t k = degree; k-- > 0;) {
+            const __m256d ck = _mm256_set1_pd(c[k]);
+            r0 = _mm256_fmadd_pd(r0, x0, ck);
+            r1 = _mm256_fmadd_pd(r1, x1, ck);
+            r2 = _mm256_fmadd_pd(r2, x2, ck);
+            r3 = _mm256_fmadd_pd(r3, x3, ck);
+        }
+        _mm256_storeu_pd(a + i, r0);
+        _mm256_storeu_pd(a + i + 4, r1);
+        _mm256_storeu_pd(a + i + 8, r2);
+        _mm256_storeu_pd(a + i + 12, r3);
+    }
+    hornerScalar(a + i, c, degree, n - i);
+}
+
+#endif
+
+// picks the widest kernels the running CPU supports, once
+inline const ColumnKernels& columnKernels() {
+    static const ColumnKernels kernels = [] {
+#ifdef COLUMNS_X86
+        if (__builtin_cpu_supports("avx2")) {
+            return ColumnKernels{addAvx2, subAvx2, mulAvx2, divAvx2, negAvx2, powiAvx2,
+                                 __builtin_cpu_supports("fma") ? hornerAvx2 : hornerScalar};
+        }
+        if (__builtin_cpu_supports("sse2")) {
+            return ColumnKernels{addSse2, subSse2, mulSse2, divSse2, negSse2, powiSse2, hornerScalar};
+        }
+#endif
+        return ColumnKernels{addScalar, subScalar, mulScalar, divScalar, negScalar, powiScalar, hornerScalar};
+    }();
+    return kernels;
+}
+
+class ColumnEvaluator {
+public:
+    explicit ColumnEvaluator(const TreeNode* root) : program(Compiler::compile(root)) {}
+
+    // out[row] = expression evaluated with vars[slot] = columns[slot][row], for row in [0, rows)
+    void eval(const double* const* columns, size_t rows, double* out) const {
+        const ColumnKernels& k = columnKernels();
+        std::vector<double> stack(program.maxStack * COLUMN_BLOCK);
+        for (size_t begin = 0; begin < rows; begin += COLUMN_BLOCK) {
+            size_t n = rows - begin < COLUMN_BLOCK ? rows - begin : COLUMN_BLOCK;
+            double* top = stack.data() - COLUMN_BLOCK; // each stack entry is one block of values
+            const std::vector<Instruction>& code = program.code;
+            for (size_t pc = 0; pc < code.size(); pc++) {
+                const Instruction& ins = code[pc];
+                switch (ins.op) {
+                    case OpCode::PushConst: {
+                        top += COLUMN_BLOCK;
+                        double v = program.constants[ins.arg];
+                        if (pc + 1 < code.size() && code[pc + 1].op == OpCode::Pow && isSmallInt(v)) {
+                            pc++; // x^n with a constant integer n: fuse into one powi pass, no operand block
+                            top -= COLUMN_BLOCK;
+                            k.powi(top, (int)v, n);
+                            break;
+                        }
+                        std::fill(top, top + n, v);
+                        break;
+                    }
+                    case OpCode::PushVar:
+                        top += COLUMN_BLOCK;
+                        std::memcpy(top, columns[ins.arg] + begin, n * sizeof(double));
+                        break;
+                    case OpCode::Add:
+                        top -= COLUMN_BLOCK;
+                        k.add(top, top + COLUMN_BLOCK, n);
+                        break;
+                    case OpCode::Sub:
+                        top -= COLUMN_BLOCK;
+                        k.sub(top, top + COLUMN_BLOCK, n);
+                        break;
+                    case OpCode::Mul:
+                        top -= COLUMN_BLOCK;
+                        k.mul(top, top + COLUMN_BLOCK, n);
+                        break;
+                    case OpCode::Div:
+                        top -= COLUMN_BLOCK;
+                        k.div(top, top + COLUMN_BLOCK, n);
+                        break;
+                    case OpCode::Pow:
+                        top -= COLUMN_BLOCK;
+                        for (size_t i = 0; i < n; i++) {
+                            top[i] = pow(top[i], top[i + COLUMN_BLOCK]);
+                        }
+                        break;
+                    case OpCode::Neg:
+                        k.neg(top, n);
+                        break;
+                    case OpCode::Fact:
+                        for (size_t i = 0; i < n; i++) {
+                            top[i] = Factorial::fact(top[i]);
+                        }
+                        break;
+                    case OpCode::Horner:
+                        k.horner(top, &program.constants[ins.arg + 1], (uint32_t)program.constants[ins.arg], n);
+                        break;
+                }
+            }
+            std::memcpy(out + begin, top, n * sizeof(double));
+        }
+    }
+
+private:
+    Program program;
+
+    static bool isSmallInt(double v) {
+        return v >= COLUMN_MIN_POWI && v <= COLUMN_MAX_POWI && v == (int)v;
+    }
+};
+
+#endif //CALCULATOR_COLUMNS_H
@@ -0,0 +1,223 @@
+#ifndef CALCULATOR_DAG_H
+#define CALCULATOR_DAG_H
+
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#include "tree.h"
+
+/* Hash-consing: every node is identified by its kind and its operands, where operands are children that are
+ * already unique (so comparing pointers compares whole subtrees), a constant's bits or an identifier's slot.
+ * Building a tree bottom-up through a NodeTable therefore turns structurally identical subtrees into one shared
+ * node, e.g. (x+1)^2*(x+1)^3/(x+1) holds a single (x+1).
+ */
+struct NodeKey {
+    NodeKind kind;
+    uint64_t a;
+    uint64_t b;
+
+    bool operator==(const NodeKey& other) const {
+        return kind == other.kind && a == other.a && b == other.b;
+    }
+};
+
+inline NodeKey infixKey(NodeKind kind, const TreeNode* l, const TreeNode* r) {
+    return {kind, (uint64_t)(uintptr_t)l, (uint64_t)(uintptr_t)r};
+}
+
+inline NodeKey constantKey(double v) {
+    uint64_t bits;
+    std::memcpy(&bits, &v, sizeof bits);
+    return {NodeKind::Double, bits, 0};
+}
+
+// open addressing with linear probing; clear() is O(1), stale slots are told apart by their generation
+class NodeTable {
+public:
+    template<class Make>
+    TreeNode* intern(const NodeKey& key, Make make) {
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            Slot& s = slots[i];
+            if (s.generation != generation) {
+                s = {key, make(), generation};
+                count++;
+                return s.node;
+            }
+            if (s.key == key) {
+                return s.node;
+            }
+        }
+    }
+
+    void clear() {
+        if (++generation == 0) { // wrapped around: slots from 2^32 clears ago would look live again
+            slots.assign(slots.size(), Slot{{}, nullptr, 0});
+            generation = 1;
+        }
+        count = 0;
+    }
+
+private:
+    struct Slot {
+        NodeKey key;
+        TreeNode* node;
+        uint32_t generation;
+    };
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+    uint32_t generation = 1;
+
+    static size_t hash(const NodeKey& key) {
+        uint64_t h = key.a * 0x9E3779B97F4A7C15ull ^ (key.b + (uint64_t)key.kind) * 0xC2B2AE3D27D4EB4Full;
+        return (size_t)(h ^ h >> 29);
+    }
+
+    void grow() {
+        std::vector<Slot> old = std::move(slots);
+        slots.assign(old.size() < 64 ? 64 : old.size() * 2, Slot{{}, nullptr, 0});
+        size_t mask = slots.size() - 1;
+        for (const Slot& s : old) {
+            if (s.generation == generation) {
+                size_t i = hash(s.key) & mask;
+                while (slots[i].generation == generation) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = s;
+            }
+        }
+    }
+};
+
+/* Evaluates a tree whose subtrees may be shared, computing every distinct node once per evaluation. The nodes
+ * are scheduled in post-order into a flat array where operands are indices of earlier entries, and eval()
+ * fills a value array front to back.
+ */
+class DagEvaluator {
+public:
+    explicit DagEvaluator(const TreeNode* root) {
+        std::unordered_map<const TreeNode*, uint32_t> scheduled;
+        schedule(root, scheduled);
+        values.resize(nodes.size());
+    }
+
+    double eval(const double* vars) {
+        for (size_t i = 0; i < nodes.size(); i++) {
+            values[i] = compute(nodes[i], vars);
+        }
+        return values.back();
+    }
+
+    // number of distinct nodes, i.e. operations per evaluation
+    [[nodiscard]] size_t size() const {
+        return nodes.size();
+    }
+
+protected:
+    struct DagNode {
+        NodeKind kind;
+        uint32_t left; // operand index; the slot for an Identifier or a Horner node
+        uint32_t right;
+        double constant;
+        const Horner* horner = nullptr; // coefficients stay in the tree, which must outlive the evaluator
+    };
+
+    std::vector<DagNode> nodes;
+    std::vector<double> values;
+
+    double compute(const DagNode& n, const double* vars) const {
+        switch (n.kind) {
+            case NodeKind::Add:
+                return values[n.left] + values[n.right];
+            case NodeKind::Sub:
+                return values[n.left] - values[n.right];
+            case NodeKind::Mul:
+                return values[n.left] * values[n.right];
+            case NodeKind::Div:
+                return values[n.left] / values[n.right];
+            case NodeKind::Caret:
+                return pow(values[n.left], values[n.right]);
+            case NodeKind::Negate:
+                return -values[n.left];
+            case NodeKind::Factorial:
+                return Factorial::fact(values[n.left]);
+            case NodeKind::Double:
+                return n.constant;
+            case NodeKind::Identifier:
+                return vars[n.left];
+            case NodeKind::Horner:
+                return n.horner->at(vars[n.left]);
+        }
+        return 0;
+    }
+
+private:
+    // post-order with an explicit stack; a shared node is scheduled on its first visit only
+    void schedule(const TreeNode* root, std::unordered_map<const TreeNode*, uint32_t>& scheduled) {
+        struct Frame {
+            const TreeNode* node;
+            bool operandsDone;
+        };
+        WalkStack<Frame> frames;
+        frames.push({root, false});
+        while (!frames.empty()) {
+            Frame f = frames.pop();
+            const TreeNode* node = f.node;
+            if (scheduled.count(node) != 0) {
+                continue;
+            }
+            const TreeNode* operands[2] = {};
+            switch (node->kind()) {
+                case NodeKind::Add:
+                case NodeKind::Sub:
+                case NodeKind::Mul:
+                case NodeKind::Div:
+                case NodeKind::Caret:
+                    operands[0] = static_cast<const InfixOp*>(node)->left;
+                    operands[1] = static_cast<const InfixOp*>(node)->right;
+                    break;
+                case NodeKind::Negate:
+                    operands[0] = static_cast<const Negate*>(node)->arg;
+                    break;
+                case NodeKind::Factorial:
+                    operands[0] = static_cast<const Factorial*>(node)->arg;
+                    break;
+                default:
+                    break;
+            }
+            if (operands[0] != nullptr && !f.operandsDone) {
+                frames.push({node, true});
+                if (operands[1] != nullptr) {
+                    frames.push({operands[1], false});
+                }
+                frames.push({operands[0], false});
+                continue;
+            }
+            DagNode n{node->kind(), 0, 0, 0};
+            if (operands[0] != nullptr) {
+                n.left = scheduled[operands[0]];
+            }
+            if (operands[1] != nullptr) {
+                n.right = scheduled[operands[1]];
+            }
+            if (node->kind() == NodeKind::Double) {
+                n.constant = static_cast<const Double*>(node)->val;
+            } else if (node->kind() == NodeKind::Identifier) {
+                n.left = static_cast<const Identifier*>(node)->slot;
+            } else if (node->kind() == NodeKind::Horner) {
+                n.horner = static_cast<const Horner*>(node);
+                n.left = n.horner->slot;
+            }
+            nodes.push_back(n);
+            scheduled[node] = (uint32_t)(nodes.size() - 1);
+        }
+    }
+};
+
+#endif //CALCULATOR_DAG_H
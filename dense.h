@@ -0,0 +1,359 @@
+#ifndef CALCULATOR_DENSE_H
+#define CALCULATOR_DENSE_H
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#define DENSE_KARATSUBA_MIN 32 // shorter operands are multiplied by schoolbook
+#define DENSE_FFT_MIN 512 // shorter real operands are multiplied by Karatsuba, longer ones by FFT
+#define DENSE_NTT_MAX_LENGTH (1 << 23) // the largest power-of-two transform every NTT prime supports
+#define DENSE_NTT_BOUND 0x1p84 // products of integers below this are exact through the NTT primes
+#define DENSE_FFT_MAX_RANGE 0x1p10 // results this much smaller than the largest are recomputed, see multiplyFast()
+#define DENSE_NOISE_ULPS 16 // results within this many rounding errors of zero are zero
+
+/* Products of dense univariate polynomials, given as coefficient arrays in order of increasing degree.
+ * multiplyDense() picks the algorithm from the operands:
+ * - schoolbook below DENSE_KARATSUBA_MIN coefficients, where it is fastest;
+ * - an NTT modulo three primes with CRT reconstruction when all coefficients are integers and the result's are
+ *   known to stay below DENSE_NTT_BOUND: exact, and O(n log n);
+ * - otherwise Karatsuba, O(n^1.58), then a floating-point FFT from DENSE_FFT_MIN on, O(n log n), with
+ *   the results they cannot get accurately recomputed directly (see multiplyFast()); when those are too many,
+ *   as for the binomial coefficients of (x + 1)^200, schoolbook after all.
+ * Coefficients must be finite.
+ */
+
+inline void multiplySchoolbook(const double* a, size_t n, const double* b, size_t m, double* out) {
+    for (size_t i = 0; i < n; i++) {
+        if (a[i] == 0) {
+            continue;
+        }
+        for (size_t j = 0; j < m; j++) {
+            out[i + j] += a[i] * b[j];
+        }
+    }
+}
+
+// out[0, 2n - 1) += a * b for two operands of n coefficients; scratch needs 8n
+inline void karatsuba(const double* a, const double* b, size_t n, double* out, double* scratch) {
+    if (n < DENSE_KARATSUBA_MIN) {
+        multiplySchoolbook(a, n, b, n, out);
+        return;
+    }
+    size_t low = n / 2, high = n - low; // a = a0 + x^low * a1, with a1 not shorter than a0
+    double* sa = scratch; // a0 + a1
+    double* sb = scratch + high; // b0 + b1
+    double* mid = scratch + 2 * high; // (a0 + a1)(b0 + b1), 2 * high - 1 coefficients
+    double* next = scratch + 4 * high;
+    for (size_t i = 0; i < high; i++) {
+        sa[i] = a[low + i] + (i < low ? a[i] : 0);
+        sb[i] = b[low + i] + (i < low ? b[i] : 0);
+    }
+    std::vector<double> z0(2 * low - 1), z2(2 * high - 1);
+    std::fill(mid, mid + 2 * high - 1, 0.0);
+    karatsuba(a, b, low, z0.data(), next);
+    karatsuba(a + low, b + low, high, z2.data(), next);
+    karatsuba(sa, sb, high, mid, next);
+    for (size_t i = 0; i < z0.size(); i++) {
+        out[i] += z0[i];
+        mid[i] -= z0[i];
+    }
+    for (size_t i = 0; i < z2.size(); i++) {
+        out[2 * low + i] += z2[i];
+        mid[i] -= z2[i];
+    }
+    for (size_t i = 0; i < 2 * high - 1; i++) {
+        out[low + i] += mid[i];
+    }
+}
+
+// unbalanced operands are cut into pieces as long as the shorter one, each a balanced Karatsuba product
+inline void multiplyKaratsuba(const double* a, size_t n, const double* b, size_t m, double* out) {
+    if (n < m) {
+        std::swap(a, b);
+        std::swap(n, m);
+    }
+    std::vector<double> piece(m), product(2 * m - 1), scratch(8 * m + 64);
+    for (size_t start = 0; start < n; start += m) {
+        size_t len = std::min(m, n - start);
+        std::copy(a + start, a + start + len, piece.begin());
+        std::fill(piece.begin() + len, piece.end(), 0.0);
+        std::fill(product.begin(), product.end(), 0.0);
+        karatsuba(piece.data(), b, m, product.data(), scratch.data());
+        for (size_t i = 0; i < product.size() && start + i < n + m - 1; i++) {
+            out[start + i] += product[i];
+        }
+    }
+}
+
+// in-place iterative radix-2 transform; roots[len / 2 + k] = e^(-2 pi i k / len) for the stage of length len, so
+// every stage reads its twiddles front to back
+inline void fft(std::vector<std::complex<double>>& a, const std::vector<std::complex<double>>& roots, bool inverse) {
+    size_t size = a.size();
+    for (size_t i = 1, j = 0; i < size; i++) { // bit-reversal permutation
+        size_t bit = size >> 1;
+        for (; j & bit; bit >>= 1) {
+            j ^= bit;
+        }
+        j |= bit;
+        if (i < j) {
+            std::swap(a[i], a[j]);
+        }
+    }
+    for (size_t len = 2; len <= size; len <<= 1) {
+        const std::complex<double>* w = roots.data() + len / 2;
+        for (size_t i = 0; i < size; i += len) {
+            for (size_t k = 0; k < len / 2; k++) {
+                // spelled out: std::complex's operator* checks for NaN and infinity in a library call
+                double wr = w[k].real(), wi = inverse ? -w[k].imag() : w[k].imag();
+                double xr = a[i + k + len / 2].real(), xi = a[i + k + len / 2].imag();
+                std::complex<double> u = a[i + k], v(xr * wr - xi * wi, xr * wi + xi * wr);
+                a[i + k] = u + v;
+                a[i + k + len / 2] = u - v;
+            }
+        }
+    }
+}
+
+// both real operands travel in one complex transform as p = a + i b, then a * b = (p^2 - conj(p(-x))^2) / 4i;
+// they are scaled to a largest magnitude of 1 first, so neither overflows nor drowns the other
+inline void multiplyFft(const double* a, size_t n, const double* b, size_t m, double* out) {
+    size_t size = 1;
+    while (size < n + m - 1) {
+        size <<= 1;
+    }
+    const double pi = std::acos(-1.0);
+    std::vector<std::complex<double>> roots(std::max(size, (size_t)2));
+    for (size_t k = 0; k < size / 2; k++) { // each root directly from cos and sin, rounding errors do not pile up
+        double angle = -2 * pi * (double)k / (double)size;
+        roots[size / 2 + k] = {std::cos(angle), std::sin(angle)};
+    }
+    for (size_t half = size / 4; half >= 1; half /= 2) { // shorter stages use every other root of the next one
+        for (size_t k = 0; k < half; k++) {
+            roots[half + k] = roots[2 * half + 2 * k];
+        }
+    }
+    double maxA = 0, maxB = 0;
+    for (size_t i = 0; i < n; i++) {
+        maxA = std::max(maxA, std::fabs(a[i]));
+    }
+    for (size_t i = 0; i < m; i++) {
+        maxB = std::max(maxB, std::fabs(b[i]));
+    }
+    if (maxA == 0 || maxB == 0) {
+        return;
+    }
+    std::vector<std::complex<double>> p(size);
+    for (size_t i = 0; i < n; i++) {
+        p[i].real(a[i] / maxA);
+    }
+    for (size_t i = 0; i < m; i++) {
+        p[i].imag(b[i] / maxB);
+    }
+    fft(p, roots, false);
+    std::vector<std::complex<double>> q(size);
+    for (size_t k = 0; k < size; k++) { // (x^2 - y^2) / 4i = (x - y)(x + y) / 4i
+        std::complex<double> x = p[k], y = std::conj(p[(size - k) & (size - 1)]);
+        std::complex<double> d = x - y, s = x + y;
+        double re = d.real() * s.real() - d.imag() * s.imag(), im = d.real() * s.imag() + d.imag() * s.real();
+        q[k] = {im * 0.25, -re * 0.25};
+    }
+    fft(q, roots, true);
+    for (size_t i = 0; i < n + m - 1; i++) {
+        out[i] += q[i].real() / (double)size * maxA * maxB;
+    }
+}
+
+// number-theoretic transform modulo a prime P = c * 2^k + 1 with primitive root G
+template<uint32_t P, uint32_t G>
+struct Ntt {
+    static uint32_t power(uint64_t base, uint64_t e) {
+        uint64_t r = 1;
+        for (base %= P; e != 0; e >>= 1, base = base * base % P) {
+            if (e & 1) {
+                r = r * base % P;
+            }
+        }
+        return (uint32_t)r;
+    }
+
+    static void transform(std::vector<uint32_t>& a, bool inverse) {
+        size_t size = a.size();
+        for (size_t i = 1, j = 0; i < size; i++) {
+            size_t bit = size >> 1;
+            for (; j & bit; bit >>= 1) {
+                j ^= bit;
+            }
+            j |= bit;
+            if (i < j) {
+                std::swap(a[i], a[j]);
+            }
+        }
+        std::vector<uint32_t> w(size / 2), wq(size / 2); // twiddles, and w * 2^32 / P for Shoup's multiplication
+        for (size_t len = 2; len <= size; len <<= 1) {
+            uint32_t root = power(G, (P - 1) / len);
+            if (inverse) {
+                root = power(root, P - 2);
+            }
+            w[0] = 1;
+            for (size_t k = 1; k < len / 2; k++) {
+                w[k] = (uint32_t)((uint64_t)w[k - 1] * root % P);
+            }
+            for (size_t k = 0; k < len / 2; k++) {
+                wq[k] = (uint32_t)(((uint64_t)w[k] << 32) / P);
+            }
+            for (size_t i = 0; i < size; i += len) {
+                for (size_t k = 0; k < len / 2; k++) {
+                    uint32_t u = a[i + k], x = a[i + k + len / 2];
+                    // x * w mod P without a division: the quotient estimate is off by at most one
+                    auto q = (uint32_t)(((uint64_t)x * wq[k]) >> 32);
+                    uint32_t v = x * w[k] - q * P;
+                    v = v >= P ? v - P : v;
+                    a[i + k] = u + v >= P ? u + v - P : u + v;
+                    a[i + k + len / 2] = u >= v ? u - v : u + P - v;
+                }
+            }
+        }
+        if (inverse) {
+            uint64_t scale = power(size, P - 2);
+            for (uint32_t& x : a) {
+                x = (uint32_t)(x * scale % P);
+            }
+        }
+    }
+
+    // the product modulo P of integer operands given as doubles
+    static std::vector<uint32_t> multiply(const double* a, size_t n, const double* b, size_t m, size_t size) {
+        std::vector<uint32_t> x(size), y(size);
+        auto reduce = [](double c) {
+            auto r = (int64_t)(std::fmod(c, (double)P));
+            return (uint32_t)(r < 0 ? r + P : r);
+        };
+        for (size_t i = 0; i < n; i++) {
+            x[i] = reduce(a[i]);
+        }
+        for (size_t i = 0; i < m; i++) {
+            y[i] = reduce(b[i]);
+        }
+        transform(x, false);
+        transform(y, false);
+        for (size_t i = 0; i < size; i++) {
+            x[i] = (uint32_t)((uint64_t)x[i] * y[i] % P);
+        }
+        transform(x, true);
+        return x;
+    }
+};
+
+// exact product of integer operands whose result coefficients are below bound <= DENSE_NTT_BOUND in magnitude;
+// small bounds need only one or two of the primes
+inline void multiplyNtt(const double* a, size_t n, const double* b, size_t m, double bound, double* out) {
+    constexpr uint64_t p1 = 998244353, p2 = 167772161, p3 = 469762049;
+    int primes = bound < (double)p1 / 2 ? 1 : bound < (double)p1 * (double)p2 / 2 ? 2 : 3;
+    size_t size = 1;
+    while (size < n + m - 1) {
+        size <<= 1;
+    }
+    std::vector<uint32_t> r1 = Ntt<p1, 3>::multiply(a, n, b, m, size), r2, r3;
+    if (primes >= 2) {
+        r2 = Ntt<p2, 3>::multiply(a, n, b, m, size);
+    }
+    if (primes == 3) {
+        r3 = Ntt<p3, 3>::multiply(a, n, b, m, size);
+    }
+    // Garner: x = x1 + p1 * x2 + p1 * p2 * x3 with every xi below its prime
+    const uint64_t inv1 = Ntt<p2, 3>::power(p1, p2 - 2);
+    const uint64_t inv12 = Ntt<p3, 3>::power(p1 % p3 * (p2 % p3), p3 - 2);
+    const unsigned __int128 modulus = primes == 1 ? p1 : primes == 2 ? p1 * p2 : (unsigned __int128)(p1 * p2) * p3;
+    for (size_t i = 0; i < n + m - 1; i++) {
+        uint64_t x1 = r1[i];
+        uint64_t x2 = primes < 2 ? 0 : (r2[i] + p2 - x1 % p2) % p2 * inv1 % p2;
+        uint64_t x3 = primes < 3 ? 0 : (r3[i] + p3 - (x1 + p1 % p3 * x2) % p3) % p3 * inv12 % p3;
+        unsigned __int128 x = x1 + (unsigned __int128)p1 * x2 + (unsigned __int128)(p1 * p2) * x3;
+        out[i] += x > modulus / 2 ? -(double)(modulus - x) : (double)x; // the upper half are negative values
+    }
+}
+
+// a * b by Karatsuba or FFT, whose rounding errors are relative to the largest result rather than to each one.
+// The scale of every result, sum |a_i| |b_j| over its terms, comes from the same algorithm on |a| and |b|; results
+// more than DENSE_FFT_MAX_RANGE below the largest scale are summed directly instead, and results within the
+// rounding error of zero are zero. Returns false without touching out if the direct sums would cost more than a
+// quarter of schoolbook.
+inline bool multiplyFast(const double* a, size_t n, const double* b, size_t m, double* out) {
+    size_t length = n + m - 1;
+    auto product = [&](const double* x, const double* y, double* z) {
+        if (std::min(n, m) < DENSE_FFT_MIN) {
+            multiplyKaratsuba(x, n, y, m, z);
+        } else {
+            multiplyFft(x, n, y, m, z);
+        }
+    };
+    std::vector<double> absA(n), absB(m), scale(length);
+    std::transform(a, a + n, absA.begin(), [](double c) { return std::fabs(c); });
+    std::transform(b, b + m, absB.begin(), [](double c) { return std::fabs(c); });
+    product(absA.data(), absB.data(), scale.data());
+    double maxScale = *std::max_element(scale.begin(), scale.end());
+    double noise = DENSE_NOISE_ULPS * DBL_EPSILON * std::log2((double)length + 1) * maxScale;
+    std::vector<size_t> direct;
+    size_t work = 0;
+    for (size_t k = 0; k < length; k++) {
+        if (scale[k] < maxScale / DENSE_FFT_MAX_RANGE) {
+            direct.push_back(k);
+            work += std::min(k, n - 1) + 1 - (k >= m ? k - m + 1 : 0); // terms of result k
+            if (work > n * m / 4) {
+                return false;
+            }
+        }
+    }
+    product(a, b, out);
+    for (size_t k = 0; k < length; k++) {
+        if (std::fabs(out[k]) <= noise) {
+            out[k] = 0;
+        }
+    }
+    for (size_t k : direct) {
+        double sum = 0;
+        for (size_t i = k >= m ? k - m + 1 : 0; i <= std::min(k, n - 1); i++) {
+            sum += a[i] * b[k - i];
+        }
+        out[k] = sum;
+    }
+    return true;
+}
+
+inline std::vector<double> multiplyDense(const std::vector<double>& a, const std::vector<double>& b) {
+    if (a.empty() || b.empty()) {
+        return {};
+    }
+    size_t n = a.size(), m = b.size(), length = n + m - 1;
+    std::vector<double> out(length);
+    if (std::min(n, m) < DENSE_KARATSUBA_MIN) {
+        multiplySchoolbook(a.data(), n, b.data(), m, out.data());
+        return out;
+    }
+    bool integers = true;
+    double maxA = 0, maxB = 0;
+    for (double c : a) {
+        integers &= c == std::floor(c);
+        maxA = std::max(maxA, std::fabs(c));
+    }
+    for (double c : b) {
+        integers &= c == std::floor(c);
+        maxB = std::max(maxB, std::fabs(c));
+    }
+    double bound = maxA * maxB * (double)std::min(n, m); // no result coefficient is larger
+    if (integers && bound < DENSE_NTT_BOUND && length <= DENSE_NTT_MAX_LENGTH) {
+        multiplyNtt(a.data(), n, b.data(), m, bound, out.data());
+        return out;
+    }
+    // with results that may overflow, only schoolbook confines the infinities to the results concerned
+    if (!std::isfinite(bound) || !multiplyFast(a.data(), n, b.data(), m, out.data())) {
+        multiplySchoolbook(a.data(), n, b.data(), m, out.data());
+    }
+    return out;
+}
+
+#endif //CALCULATOR_DENSE_H
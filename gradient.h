@@ -0,0 +1,202 @@
+#ifndef CALCULATOR_GRADIENT_H
+#define CALCULATOR_GRADIENT_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "bytecode.h"
+
+#define DIGAMMA_ASYMPTOTIC_MIN 10 // smaller arguments are shifted up by the recurrence before the series is used
+
+// psi(x) = Gamma'(x) / Gamma(x); NaN at the poles 0, -1, -2, ...
+inline double digamma(double x) {
+    if (x <= 0 && x == std::floor(x)) {
+        return NAN;
+    }
+    const double pi = std::acos(-1.0);
+    double result = 0;
+    if (x < 0) { // reflection: psi(x) = psi(1 - x) - pi / tan(pi x)
+        result = -pi / std::tan(pi * x);
+        x = 1 - x;
+    }
+    for (; x < DIGAMMA_ASYMPTOTIC_MIN; x++) { // psi(x) = psi(x + 1) - 1 / x
+        result -= 1 / x;
+    }
+    // psi(x) ~ ln x - 1/2x - sum B_2k / (2k x^2k)
+    double r = 1 / (x * x);
+    double series = r * (1.0 / 12 - r * (1.0 / 120 - r * (1.0 / 252 - r * (1.0 / 240 - r * (1.0 / 132
+                    - r * (691.0 / 32760 - r * (1.0 / 12)))))));
+    return result + std::log(x) - 0.5 / x - series;
+}
+
+/* Reverse-mode automatic differentiation: the value of an expression and its partial derivatives with respect to
+ * every identifier, for about the cost of two evaluations however many identifiers there are.
+ * The tree is compiled to bytecode, whose postfix order already is a valid tape: every instruction follows its
+ * operands. Where those operands are on the tape is fixed by the code, so it is worked out once here, along with
+ * which instructions depend on an identifier at all. gradient() runs the code forward, recording each
+ * instruction's value, then sweeps the tape backwards once, passing each adjoint on to the operands:
+ *      a+b: 1, 1     a-b: 1, -1     a*b: b, a     a/b: 1/b, -(a/b)/b     -a: -1
+ *      a^b: b a^(b-1), a^b ln a     a!: a! psi(a+1), from Gamma(a+1)' = Gamma(a+1) psi(a+1)
+ *      Horner p(a): p'(a), evaluated along with p(a)
+ * a^b has no derivative for b at a < 0; it is NaN there unless b does not depend on an identifier.
+ */
+class GradientEvaluator {
+public:
+    explicit GradientEvaluator(const TreeNode* root) : program(Compiler::compile(root)) {
+        const std::vector<Instruction>& code = program.code;
+        left.resize(code.size());
+        right.resize(code.size());
+        active.resize(code.size());
+        values.resize(code.size());
+        adjoints.resize(code.size());
+        std::vector<uint32_t> stack; // tape positions of the values on the VM stack
+        for (uint32_t pc = 0; pc < code.size(); pc++) {
+            switch (code[pc].op) {
+                case OpCode::PushConst:
+                    break;
+                case OpCode::PushVar:
+                    active[pc] = true;
+                    break;
+                case OpCode::Neg:
+                case OpCode::Fact:
+                case OpCode::Horner:
+                    left[pc] = stack.back();
+                    stack.pop_back();
+                    active[pc] = active[left[pc]];
+                    break;
+                default:
+                    right[pc] = stack.back();
+                    stack.pop_back();
+                    left[pc] = stack.back();
+                    stack.pop_back();
+                    active[pc] = active[left[pc]] || active[right[pc]];
+                    break;
+            }
+            stack.push_back(pc);
+        }
+    }
+
+    // returns the value at vars and sets grad[slot] to its partial derivative for vars[slot], for every
+    // slot < varCount; vars and grad are indexed like for TreeNode::eval(), so varCount is usually the number of
+    // symbols of the parser
+    double gradient(const double* vars, double* grad, size_t varCount) {
+        const std::vector<Instruction>& code = program.code;
+        for (size_t pc = 0; pc < code.size(); pc++) { // forward: record every value
+            const Instruction& ins = code[pc];
+            double a = values[left[pc]], b = values[right[pc]];
+            switch (ins.op) {
+                case OpCode::PushConst:
+                    values[pc] = program.constants[ins.arg];
+                    break;
+                case OpCode::PushVar:
+                    values[pc] = vars[ins.arg];
+                    break;
+                case OpCode::Add:
+                    values[pc] = a + b;
+                    break;
+                case OpCode::Sub:
+                    values[pc] = a - b;
+                    break;
+                case OpCode::Mul:
+                    values[pc] = a * b;
+                    break;
+                case OpCode::Div:
+                    values[pc] = a / b;
+                    break;
+                case OpCode::Pow:
+                    values[pc] = pow(a, b);
+                    break;
+                case OpCode::Neg:
+                    values[pc] = -a;
+                    break;
+                case OpCode::Fact:
+                    values[pc] = Factorial::fact(a);
+                    break;
+                case OpCode::Horner:
+                    values[pc] = hornerKernel()(&program.constants[ins.arg + 1], degree(ins), a);
+                    break;
+            }
+        }
+
+        std::fill(grad, grad + varCount, 0.0);
+        std::fill(adjoints.begin(), adjoints.end(), 0.0);
+        adjoints.back() = 1;
+        for (size_t pc = code.size(); pc-- > 0;) { // backward: adjoints to operands, only where they depend on vars
+            double adjoint = adjoints[pc];
+            if (!active[pc] || adjoint == 0) {
+                continue;
+            }
+            const Instruction& ins = code[pc];
+            uint32_t l = left[pc], r = right[pc];
+            double a = values[l], b = values[r], v = values[pc];
+            switch (ins.op) {
+                case OpCode::PushConst:
+                    break;
+                case OpCode::PushVar:
+                    if (ins.arg < varCount) {
+                        grad[ins.arg] += adjoint;
+                    }
+                    break;
+                case OpCode::Add:
+                    adjoints[l] += adjoint;
+                    adjoints[r] += adjoint;
+                    break;
+                case OpCode::Sub:
+                    adjoints[l] += adjoint;
+                    adjoints[r] -= adjoint;
+                    break;
+                case OpCode::Mul:
+                    adjoints[l] += adjoint * b;
+                    adjoints[r] += adjoint * a;
+                    break;
+                case OpCode::Div:
+                    adjoints[l] += adjoint / b;
+                    adjoints[r] -= adjoint * v / b;
+                    break;
+                case OpCode::Pow:
+                    if (active[l]) { // b a^(b-1), from the recorded a^b unless that would divide by 0
+                        adjoints[l] += adjoint * (a != 0 ? b * v / a : b * pow(a, b - 1));
+                    }
+                    if (active[r]) {
+                        adjoints[r] += adjoint * (a > 0 ? v * std::log(a) : a == 0 && b > 0 ? 0 : NAN);
+                    }
+                    break;
+                case OpCode::Neg:
+                    adjoints[l] -= adjoint;
+                    break;
+                case OpCode::Fact:
+                    adjoints[l] += adjoint * v * digamma(a + 1);
+                    break;
+                case OpCode::Horner:
+                    adjoints[l] += adjoint * hornerDerivative(&program.constants[ins.arg + 1], degree(ins), a);
+                    break;
+            }
+        }
+        return values.back();
+    }
+
+private:
+    Program program;
+    std::vector<uint32_t> left; // tape positions of the operands; 0 where an instruction has fewer
+    std::vector<uint32_t> right;
+    std::vector<bool> active; // depends on an identifier, so its adjoint matters
+    std::vector<double> values; // the tape
+    std::vector<double> adjoints;
+
+    [[nodiscard]] uint32_t degree(const Instruction& ins) const {
+        return (uint32_t)program.constants[ins.arg];
+    }
+
+    // p'(x) by Horner's rule, carried along with p(x) itself
+    static double hornerDerivative(const double* c, uint32_t degree, double x) {
+        double p = c[degree], d = 0;
+        for (uint32_t i = degree; i-- > 0;) {
+            d = d * x + p;
+            p = p * x + c[i];
+        }
+        return d;
+    }
+};
+
+#endif //CALCULATOR_GRADIENT_H
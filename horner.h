@@ -0,0 +1,283 @@
+#ifndef CALCULATOR_HORNER_H
+#define CALCULATOR_HORNER_H
+
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "tree.h"
+#include "arena.h"
+
+#define HORNER_POW_COST 16 // a pow() call takes about as long as this many dependent multiply-adds
+#define HORNER_MAX_DEGREE (1 << 16)
+
+/* Finds polynomials in one identifier in a parsed tree and replaces them by Horner nodes (tree.h), so that
+ *      3*x^4 - x^2/2 + 7       costs 4 multiply-adds instead of two pow() calls and five other operations.
+ * A subtree qualifies if it is built from finite constants, a single identifier x, x^k with a constant integer
+ * 0 <= k <= HORNER_MAX_DEGREE, + and -, unary minus, * where one side is a single term, and / by a constant.
+ * Products of two sums and powers of sums are not expanded: that would trade the tree's rounding for
+ * cancellation between expanded terms, as for (x-1)^8 near 1 (see Expander in poly.h for that).
+ * Every maximal such subtree of degree 2 or more becomes a Horner node if its degree is below the cost of
+ * evaluating it as a tree, counting each node as one operation and each ^ as HORNER_POW_COST, so a sparse
+ * x^1000+1 stays as it is. A linear subtree such as 2*x+1 costs as much either way and is left alone.
+ * Identifier-free subtrees are treated as constants but left in place. Untouched subtrees are reused and
+ * rebuilt ones come from the arena passed in, like in Simplifier.
+ */
+class HornerRewriter {
+public:
+    explicit HornerRewriter(Arena& arena) : arena(arena) {}
+
+    // post-order with an explicit stack: what every subtree is known before its parent is looked at
+    TreeNode* rewrite(TreeNode* root) {
+        struct Frame {
+            TreeNode* node;
+            bool operandsDone;
+        };
+        WalkStack<Frame> frames;
+        parts.clear();
+        frames.push({root, false});
+        while (!frames.empty()) {
+            Frame f = frames.pop();
+            TreeNode* node = f.node;
+            switch (node->kind()) {
+                case NodeKind::Add:
+                case NodeKind::Sub:
+                case NodeKind::Mul:
+                case NodeKind::Div:
+                case NodeKind::Caret: {
+                    auto* op = static_cast<InfixOp*>(node);
+                    if (!f.operandsDone) {
+                        frames.push({node, true});
+                        frames.push({op->right, false});
+                        frames.push({op->left, false});
+                        break;
+                    }
+                    combineInfix(op);
+                    break;
+                }
+                case NodeKind::Negate:
+                case NodeKind::Factorial:
+                    if (!f.operandsDone) {
+                        frames.push({node, true});
+                        frames.push({node->kind() == NodeKind::Negate ? static_cast<Negate*>(node)->arg
+                                                                       : static_cast<Factorial*>(node)->arg, false});
+                        break;
+                    }
+                    combineUnary(node);
+                    break;
+                case NodeKind::Double:
+                    parts.push_back({node, Shape::Constant, static_cast<Double*>(node)->val});
+                    break;
+                case NodeKind::Identifier:
+                    parts.push_back({node, Shape::Polynomial, 0, static_cast<Identifier*>(node), {{1, 1}}, 1});
+                    break;
+                default: // rewritten before
+                    parts.push_back({node, Shape::Other});
+                    break;
+            }
+        }
+        return materialize(parts.back());
+    }
+
+private:
+    enum class Shape : uint8_t {
+        Constant, Polynomial, Other
+    };
+
+    struct Monomial {
+        uint32_t exponent;
+        double coef;
+    };
+
+    // what is known about one subtree
+    struct Part {
+        TreeNode* node; // the subtree as it stands, i.e. with the rewrites below it
+        Shape shape;
+        double value = 0; // of a Constant
+        const Identifier* variable = nullptr; // x of a Polynomial
+        std::vector<Monomial> terms = {}; // of a Polynomial, unordered and possibly repeating an exponent
+        uint32_t degree = 0; // of a Polynomial
+        uint64_t cost = 1; // operations node takes as a tree, for Constant and Polynomial
+    };
+
+    Arena& arena;
+    std::vector<Part> parts; // operands of the walk
+
+    // the subtree of p as it will be evaluated: a Horner node if that is cheaper
+    TreeNode* materialize(Part& p) {
+        if (p.shape != Shape::Polynomial || p.degree < 2 || p.degree >= p.cost) {
+            return p.node;
+        }
+        auto* coefs = static_cast<double*>(arena.allocate((p.degree + 1) * sizeof(double), alignof(double)));
+        std::fill(coefs, coefs + p.degree + 1, 0.0);
+        for (const Monomial& m : p.terms) {
+            coefs[m.exponent] += m.coef;
+        }
+        return arena.make<Horner>(coefs, p.degree, p.variable->str, p.variable->slot);
+    }
+
+    // a Constant that can be a coefficient
+    static bool isCoefficient(const Part& p) {
+        return p.shape == Shape::Constant && std::isfinite(p.value);
+    }
+
+    // a single term a*x^j, including constants
+    static bool isMonomial(const Part& p) {
+        return isCoefficient(p) || (p.shape == Shape::Polynomial && p.terms.size() == 1);
+    }
+
+    static Monomial monomial(const Part& p) {
+        return p.shape == Shape::Constant ? Monomial{0, p.value} : p.terms[0];
+    }
+
+    // turns a Constant operand of a polynomial in x into one
+    static void promote(Part& p, const Identifier* x) {
+        if (p.shape == Shape::Constant) {
+            p.shape = Shape::Polynomial;
+            p.variable = x;
+            p.terms = {{0, p.value}};
+            p.degree = 0;
+        }
+    }
+
+    static void scale(Part& p, Monomial m) {
+        for (Monomial& t : p.terms) {
+            t.exponent += m.exponent;
+            t.coef *= m.coef;
+        }
+        p.degree += m.exponent;
+    }
+
+    void combineUnary(TreeNode* node) {
+        Part& a = parts.back();
+        bool negate = node->kind() == NodeKind::Negate;
+        TreeNode* arg = negate ? static_cast<Negate*>(node)->arg : static_cast<Factorial*>(node)->arg;
+        if (a.shape == Shape::Constant) {
+            a.value = negate ? -a.value : Factorial::fact(a.value);
+        } else if (a.shape == Shape::Polynomial && negate) {
+            scale(a, {0, -1});
+        } else {
+            TreeNode* r = materialize(a);
+            a = {r == arg ? node : negate ? (TreeNode*)arena.make<Negate>(r) : arena.make<Factorial>(r), Shape::Other};
+            return;
+        }
+        a.node = node;
+        a.cost++;
+    }
+
+    void combineInfix(InfixOp* op) {
+        Part r = std::move(parts.back());
+        parts.pop_back();
+        Part& l = parts.back();
+        NodeKind kind = op->kind();
+        uint64_t cost = l.cost + r.cost + (kind == NodeKind::Caret ? HORNER_POW_COST : 1);
+        if (l.shape == Shape::Constant && r.shape == Shape::Constant) {
+            l.value = apply(kind, l.value, r.value);
+        } else if (!combinePolynomials(kind, l, r)) {
+            TreeNode* a = materialize(l);
+            TreeNode* b = materialize(r);
+            l = {a == op->left && b == op->right ? op : make(kind, a, b), Shape::Other};
+            return;
+        }
+        l.node = op;
+        l.cost = cost;
+    }
+
+    // l = l op r if the result is again a polynomial in one identifier that needs no expansion
+    bool combinePolynomials(NodeKind kind, Part& l, Part& r) {
+        if (l.shape == Shape::Other || r.shape == Shape::Other
+            || (l.shape == Shape::Polynomial && r.shape == Shape::Polynomial && l.variable->slot != r.variable->slot)) {
+            return false;
+        }
+        const Identifier* x = l.shape == Shape::Polynomial ? l.variable : r.variable;
+        switch (kind) {
+            case NodeKind::Add:
+            case NodeKind::Sub:
+                if ((!isCoefficient(l) && l.shape != Shape::Polynomial)
+                    || (!isCoefficient(r) && r.shape != Shape::Polynomial)) {
+                    return false;
+                }
+                promote(l, x);
+                promote(r, x);
+                if (kind == NodeKind::Sub) {
+                    scale(r, {0, -1});
+                }
+                if (r.terms.size() > l.terms.size()) { // the shorter list is appended, so long sums stay linear
+                    std::swap(l.terms, r.terms);
+                }
+                l.terms.insert(l.terms.end(), r.terms.begin(), r.terms.end());
+                l.degree = std::max(l.degree, r.degree);
+                return true;
+            case NodeKind::Mul: {
+                if ((!isMonomial(l) && !isMonomial(r)) || (l.shape == Shape::Constant && !isCoefficient(l))
+                    || (r.shape == Shape::Constant && !isCoefficient(r))) {
+                    return false;
+                }
+                if (isMonomial(l) && !isMonomial(r)) {
+                    std::swap(l, r); // the sum to l, the single term to r
+                }
+                promote(l, x);
+                Monomial m = monomial(r);
+                if ((uint64_t)l.degree + m.exponent > HORNER_MAX_DEGREE) {
+                    return false;
+                }
+                scale(l, m);
+                return true;
+            }
+            case NodeKind::Div:
+                if (l.shape != Shape::Polynomial || !isCoefficient(r) || r.value == 0) {
+                    return false;
+                }
+                for (Monomial& t : l.terms) {
+                    t.coef /= r.value;
+                }
+                return true;
+            default: { // Caret
+                if (l.shape != Shape::Polynomial || !isMonomial(l) || r.shape != Shape::Constant) {
+                    return false;
+                }
+                double k = r.value;
+                Monomial m = monomial(l);
+                if (!(k >= 0 && k <= HORNER_MAX_DEGREE && k == std::floor(k)) || m.exponent * k > HORNER_MAX_DEGREE) {
+                    return false;
+                }
+                l.terms = {{m.exponent * (uint32_t)k, pow(m.coef, k)}};
+                l.degree = m.exponent * (uint32_t)k;
+                return true;
+            }
+        }
+    }
+
+    static double apply(NodeKind kind, double a, double b) {
+        switch (kind) {
+            case NodeKind::Add:
+                return a + b;
+            case NodeKind::Sub:
+                return a - b;
+            case NodeKind::Mul:
+                return a * b;
+            case NodeKind::Div:
+                return a / b;
+            default:
+                return pow(a, b);
+        }
+    }
+
+    TreeNode* make(NodeKind kind, TreeNode* l, TreeNode* r) {
+        switch (kind) {
+            case NodeKind::Add:
+                return arena.make<Add>(l, r);
+            case NodeKind::Sub:
+                return arena.make<Sub>(l, r);
+            case NodeKind::Mul:
+                return arena.make<Mul>(l, r);
+            case NodeKind::Div:
+                return arena.make<Div>(l, r);
+            default:
+                return arena.make<Caret>(l, r);
+        }
+    }
+};
+
+#endif //CALCULATOR_HORNER_H
@@ -0,0 +1,107 @@
+#ifndef CALCULATOR_INCREMENTAL_H
+#define CALCULATOR_INCREMENTAL_H
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <queue>
+#include <vector>
+
+#include "dag.h"
+
+/* Evaluation for loops that change a few variables between evaluations of the same large expression. Every node
+ * keeps its last value; set() only queues the Identifier nodes of that slot, and value() recomputes queued nodes
+ * in schedule order (children before parents), queueing a node's parents only when its value actually changed.
+ * The work per update is the changed part of the paths from those leaves to the root.
+ */
+class IncrementalEvaluator : public DagEvaluator {
+public:
+    // vars must hold varCount values, indexed by slot; the expression is evaluated once in full here
+    IncrementalEvaluator(const TreeNode* root, const double* vars, size_t varCount)
+            : DagEvaluator(root), vars(vars, vars + varCount), parents(nodes.size()), queued(nodes.size()) {
+        for (uint32_t i = 0; i < nodes.size(); i++) {
+            const DagNode& n = nodes[i];
+            switch (n.kind) {
+                case NodeKind::Double:
+                    break;
+                case NodeKind::Identifier:
+                case NodeKind::Horner:
+                    if (n.left >= leaves.size()) {
+                        leaves.resize(n.left + 1);
+                    }
+                    leaves[n.left].push_back(i);
+                    break;
+                case NodeKind::Negate:
+                case NodeKind::Factorial:
+                    parents[n.left].push_back(i);
+                    break;
+                default:
+                    parents[n.left].push_back(i);
+                    if (n.right != n.left) {
+                        parents[n.right].push_back(i);
+                    }
+                    break;
+            }
+        }
+        DagEvaluator::eval(this->vars.data());
+    }
+
+    // false, and nothing changes, if slot is not below the varCount given to the constructor
+    bool set(uint32_t slot, double value) {
+        if (slot >= vars.size()) {
+            return false;
+        }
+        if (same(vars[slot], value)) {
+            return true;
+        }
+        vars[slot] = value;
+        if (slot < leaves.size()) {
+            for (uint32_t leaf : leaves[slot]) {
+                enqueue(leaf);
+            }
+        }
+        return true;
+    }
+
+    // the value of the expression under the current variables
+    double value() {
+        while (!pending.empty()) {
+            uint32_t i = pending.top();
+            pending.pop();
+            queued[i] = false;
+            double v = compute(nodes[i], vars.data());
+            if (same(v, values[i])) {
+                continue;
+            }
+            values[i] = v;
+            for (uint32_t parent : parents[i]) {
+                enqueue(parent);
+            }
+        }
+        return values.back();
+    }
+
+private:
+    std::vector<double> vars;
+    std::vector<std::vector<uint32_t>> parents;
+    std::vector<std::vector<uint32_t>> leaves; // Identifier and Horner nodes of each slot
+    std::vector<bool> queued;
+    std::priority_queue<uint32_t, std::vector<uint32_t>, std::greater<>> pending; // lowest index first
+
+    // unchanged as far as any parent can tell: -0 and +0 differ (1/x), all NaNs are alike
+    static bool same(double a, double b) {
+        uint64_t x, y;
+        std::memcpy(&x, &a, sizeof x);
+        std::memcpy(&y, &b, sizeof y);
+        return x == y || (a != a && b != b);
+    }
+
+    void enqueue(uint32_t i) {
+        if (!queued[i]) {
+            queued[i] = true;
+            pending.push(i);
+        }
+    }
+};
+
+#endif //CALCULATOR_INCREMENTAL_H
@@ -0,0 +1,257 @@
+#ifndef CALCULATOR_JIT_H
+#define CALCULATOR_JIT_H
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "tree.h"
+
+#define JIT_MAX_DEPTH 10000 // the code generator recurses per level; deeper trees run on the interpreter
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#include <sys/mman.h>
+#define JIT_NATIVE
+#endif
+
+/* Native code for hot expressions. On x86-64 System V targets a tree is compiled into straight-line SSE2 code
+ * with the signature double(const double* vars): results live in xmm0, pending left operands are spilled to the
+ * native stack, leaf right operands are used straight from memory (vars through rbx, constants RIP-relative),
+ * and Caret/Factorial call pow() and Factorial::fact(), Horner nodes their at() with the node as argument.
+ * The code is written to an anonymous mapping that is made read+execute only after it is complete.
+ * Elsewhere, for node kinds the code generator does not know, or for trees nested deeper than JIT_MAX_DEPTH,
+ * the function falls back to TreeNode::eval(); either way the tree must outlive the JitFunction.
+ */
+class JitFunction {
+public:
+    using Fn = double (*)(const double* vars);
+
+    explicit JitFunction(const TreeNode* root) : root(root) {
+#ifdef JIT_NATIVE
+        compile();
+#endif
+    }
+    JitFunction(const JitFunction&) = delete;
+    JitFunction& operator=(const JitFunction&) = delete;
+    JitFunction(JitFunction&& other) noexcept : root(other.root), fn(other.fn), page(other.page), pageSize(other.pageSize) {
+        other.fn = nullptr;
+        other.page = nullptr;
+    }
+    ~JitFunction() {
+#ifdef JIT_NATIVE
+        if (page != nullptr) {
+            munmap(page, pageSize);
+        }
+#endif
+    }
+
+    double operator()(const double* vars) const {
+        return fn != nullptr ? fn(vars) : root->eval(vars);
+    }
+
+    // the native entry point, or nullptr if this expression runs on the tree interpreter
+    [[nodiscard]] Fn function() const {
+        return fn;
+    }
+
+private:
+    const TreeNode* root;
+    Fn fn = nullptr;
+    void* page = nullptr;
+    size_t pageSize = 0;
+
+#ifdef JIT_NATIVE
+    std::vector<uint8_t> code;
+    std::vector<double> constants;
+    std::vector<std::pair<size_t, size_t>> constantFixups; // (offset of rel32, constant index)
+    std::vector<size_t> signFixups; // offsets of rel32 operands referring to the sign mask
+    size_t depth = 0; // 8-byte spills currently on the native stack
+    size_t nesting = 0; // levels of emit() currently active
+
+    void bytes(std::initializer_list<uint8_t> b) {
+        code.insert(code.end(), b);
+    }
+
+    void imm32(uint32_t v) {
+        for (int i = 0; i < 4; i++) {
+            code.push_back((uint8_t)(v >> (8 * i)));
+        }
+    }
+
+    void imm64(uint64_t v) {
+        imm32((uint32_t)v);
+        imm32((uint32_t)(v >> 32));
+    }
+
+    // <prefix> 0F <op> with a memory operand for xmm<reg> that is either vars[slot] or a constant
+    void memoryOperand(uint8_t prefix, uint8_t op, int reg, const TreeNode* leaf) {
+        bytes({prefix, 0x0F, op});
+        if (leaf->kind() == NodeKind::Identifier) {
+            code.push_back((uint8_t)(0x83 | reg << 3)); // [rbx + disp32]
+            imm32(static_cast<const Identifier*>(leaf)->slot * 8);
+        } else {
+            code.push_back((uint8_t)(0x05 | reg << 3)); // [rip + disp32]
+            constantFixups.emplace_back(code.size(), constants.size());
+            constants.push_back(static_cast<const Double*>(leaf)->val);
+            imm32(0);
+        }
+    }
+
+    static double power(double base, double exponent) {
+        return pow(base, exponent);
+    }
+
+    static double horner(double x, const Horner* node) {
+        return node->at(x);
+    }
+
+    static bool isLeaf(const TreeNode* node) {
+        return node->kind() == NodeKind::Double || node->kind() == NodeKind::Identifier;
+    }
+
+    void spill() { // sub rsp, 8; movsd [rsp], xmm0
+        bytes({0x48, 0x83, 0xEC, 0x08, 0xF2, 0x0F, 0x11, 0x04, 0x24});
+        depth++;
+    }
+
+    void unspillToXmm0() { // movapd xmm1, xmm0; movsd xmm0, [rsp]; add rsp, 8
+        bytes({0x66, 0x0F, 0x28, 0xC8, 0xF2, 0x0F, 0x10, 0x04, 0x24, 0x48, 0x83, 0xC4, 0x08});
+        depth--;
+    }
+
+    void call(const void* target) {
+        bool pad = depth % 2 != 0; // the stack must be 16-byte aligned at the call
+        if (pad) {
+            bytes({0x48, 0x83, 0xEC, 0x08});
+        }
+        bytes({0x48, 0xB8}); // mov rax, imm64; call rax
+        imm64((uint64_t)(uintptr_t)target);
+        bytes({0xFF, 0xD0});
+        if (pad) {
+            bytes({0x48, 0x83, 0xC4, 0x08});
+        }
+    }
+
+    // leaves the value of node in xmm0; false if the node kind is not supported or the tree is too deep
+    bool emit(const TreeNode* node) {
+        if (nesting == JIT_MAX_DEPTH) {
+            return false;
+        }
+        nesting++;
+        bool ok = emitNode(node);
+        nesting--;
+        return ok;
+    }
+
+    bool emitNode(const TreeNode* node) {
+        switch (node->kind()) {
+            case NodeKind::Double:
+            case NodeKind::Identifier:
+                memoryOperand(0xF2, 0x10, 0, node); // movsd xmm0, m64
+                return true;
+            case NodeKind::Negate:
+                if (!emit(static_cast<const Negate*>(node)->arg)) {
+                    return false;
+                }
+                bytes({0x66, 0x0F, 0x57, 0x05}); // xorpd xmm0, [rip + sign mask]
+                signFixups.push_back(code.size());
+                imm32(0);
+                return true;
+            case NodeKind::Factorial:
+                if (!emit(static_cast<const Factorial*>(node)->arg)) {
+                    return false;
+                }
+                call((const void*)&Factorial::fact);
+                return true;
+            case NodeKind::Horner:
+                bytes({0xF2, 0x0F, 0x10, 0x83}); // movsd xmm0, [rbx + disp32]
+                imm32(static_cast<const Horner*>(node)->slot * 8);
+                bytes({0x48, 0xBF}); // mov rdi, imm64: the node is the second argument
+                imm64((uint64_t)(uintptr_t)node);
+                call((const void*)&horner);
+                return true;
+            case NodeKind::Add:
+            case NodeKind::Sub:
+            case NodeKind::Mul:
+            case NodeKind::Div:
+            case NodeKind::Caret:
+                return emitInfix(static_cast<const InfixOp*>(node));
+        }
+        return false;
+    }
+
+    bool emitInfix(const InfixOp* node) {
+        static const uint8_t ops[] = {0x58, 0x5C, 0x59, 0x5E}; // addsd, subsd, mulsd, divsd
+        bool caret = node->kind() == NodeKind::Caret;
+        if (!emit(node->left)) {
+            return false;
+        }
+        if (isLeaf(node->right)) {
+            if (caret) {
+                memoryOperand(0xF2, 0x10, 1, node->right); // movsd xmm1, m64
+            } else {
+                memoryOperand(0xF2, ops[(int)node->kind()], 0, node->right); // <op>sd xmm0, m64
+            }
+        } else {
+            spill();
+            if (!emit(node->right)) {
+                return false;
+            }
+            unspillToXmm0();
+            if (!caret) {
+                bytes({0xF2, 0x0F, ops[(int)node->kind()], 0xC1}); // <op>sd xmm0, xmm1
+            }
+        }
+        if (caret) {
+            call((const void*)&power);
+        }
+        return true;
+    }
+
+    void compile() {
+        bytes({0x53, 0x48, 0x89, 0xFB}); // push rbx; mov rbx, rdi
+        if (!emit(root)) {
+            return;
+        }
+        bytes({0x5B, 0xC3}); // pop rbx; ret
+
+        // data follows the code: the 16-byte aligned sign mask for xorpd, then the constants
+        size_t data = (code.size() + 15) & ~(size_t)15;
+        size_t size = data + 16 + constants.size() * 8;
+        std::vector<uint8_t> image(size, 0xCC);
+        std::memcpy(image.data(), code.data(), code.size());
+        uint64_t mask[2] = {0x8000000000000000ull, 0};
+        std::memcpy(image.data() + data, mask, 16);
+        std::memcpy(image.data() + data + 16, constants.data(), constants.size() * 8);
+        auto patch = [&](size_t at, size_t target) {
+            auto rel = (int32_t)(target - (at + 4)); // relative to the end of the instruction
+            std::memcpy(image.data() + at, &rel, 4);
+        };
+        for (size_t at : signFixups) {
+            patch(at, data);
+        }
+        for (auto& [at, index] : constantFixups) {
+            patch(at, data + 16 + index * 8);
+        }
+
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return;
+        }
+        std::memcpy(p, image.data(), size);
+        if (mprotect(p, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(p, size);
+            return;
+        }
+        page = p;
+        pageSize = size;
+        fn = (Fn)p;
+        code = {};
+        constants = {};
+        constantFixups = {};
+        signFixups = {};
+    }
+#endif
+};
+
+#endif //CALCULATOR_JIT_H
@@ -1,395 +1,225 @@
-#pragma clang diagnostic push
-#pragma ide diagnostic ignored "misc-no-recursion"
-
-/* Syntax:
- *      Expression: T {+ | - T}
- *      Term: TV {* | / TV}
- *      TermVIP: F {^ F}
- *      Factor: Identifier | Double | (E) | -F | F!
- */
-
 #include <iostream>
+#include <cstdio>
+#include <csignal>
+#include <cstdlib>
 #include <cstring>
-#include <cmath>
-
-class TreeNode {
-public:
-    [[nodiscard]] virtual double eval() const = 0;
-    virtual void print() const = 0;
-    virtual ~TreeNode() = default;
-};
-
-class InfixOp : public TreeNode {
-public:
-    TreeNode* left;
-    TreeNode* right;
-    InfixOp(TreeNode* l, TreeNode* r) : TreeNode(), left(l), right(r) {};
-    ~InfixOp() override {
-        delete left;
-        delete right;
-    }
-};
-
-class Add : public InfixOp {
-public:
-    Add(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
-    [[nodiscard]] double eval() const override {
-        return left->eval() + right->eval();
-    }
-    void print() const override {
-        std::cout << "(";
-        left->print();
-        std::cout << "+";
-        right->print();
-        std::cout << ")";
-    }
-};
-
-class Sub : public InfixOp {
-public:
-    Sub(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
-    [[nodiscard]] double eval() const override {
-        return left->eval() - right->eval();
-    }
-    void print() const override {
-        std::cout << "(";
-        left->print();
-        std::cout << "-";
-        right->print();
-        std::cout << ")";
-    }
-};
-
-class Mul : public InfixOp {
-public:
-    Mul(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
-    [[nodiscard]] double eval() const override {
-        return left->eval() * right->eval();
-    }
-    void print() const override {
-        std::cout << "(";
-        left->print();
-        std::cout << "*";
-        right->print();
-        std::cout << ")";
-    }
-};
-
-class Div : public InfixOp {
-public:
-    Div(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
-    [[nodiscard]] double eval() const override {
-        return left->eval() / right->eval();
-    }
-    void print() const override {
-        std::cout << "(";
-        left->print();
-        std::cout << "/";
-        right->print();
-        std::cout << ")";
-    }
-};
-
-class Caret : public InfixOp {
-public:
-    Caret(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
-    [[nodiscard]] double eval() const override {
-        return pow(left->eval(), right->eval());
-    }
-    void print() const override {
-        std::cout << "(";
-        left->print();
-        std::cout << "^";
-        right->print();
-        std::cout << ")";
-    }
-};
+#include <string>
+#include <vector>
 
-class Negate : public TreeNode {
-public:
-    TreeNode* arg;
-    explicit Negate(TreeNode* a) : TreeNode(), arg(a) {};
-    ~Negate() override {
-        delete arg;
-    }
-    [[nodiscard]] double eval() const override {
-        return -arg->eval();
-    }
-    void print() const override {
-        std::cout << "(-";
-        arg->print();
-        std::cout << ")";
-    }
-};
+#include "parser.h"
+#include "batch.h"
+#include "server.h"
+#include "simplify.h"
+#include "poly.h"
+#include "multipoint.h"
+#include "gradient.h"
 
-class Factorial : public TreeNode {
-public:
-    TreeNode* arg;
-    explicit Factorial(TreeNode* a) : TreeNode(), arg(a) {};
-    ~Factorial() override {
-        delete arg;
-    }
-    [[nodiscard]] double eval() const override {
-        return fact((int)arg->eval());
-    }
-    void print() const override {
-        std::cout << "(";
-        arg->print();
-        std::cout << "!)";
+int main(int argc, char** argv) {
+    if (argc == 1) {
+        std::cout << "Please input an expression.\n";
+        return -1;
     }
-    [[nodiscard]] double fact(int in, int acc = 1) const {
-        if (in == 0) {
-            return acc;
+    // --batch [file|-] [--threads N] [--cache N]: one expression per line, one result per line;
+    // --cache keeps up to N compiled expressions per thread for inputs that repeat formulas
+    if (std::strcmp(argv[1], "--batch") == 0) {
+        const char* path = "-";
+        unsigned threads = std::thread::hardware_concurrency();
+        size_t cacheCapacity = 0;
+        for (int i = 2; i < argc; i++) {
+            if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+                threads = (unsigned) atoi(argv[++i]);
+            } else if (std::strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+                cacheCapacity = (size_t) atol(argv[++i]);
+            } else {
+                path = argv[i];
+            }
         }
-        if (in < 0) {
-            return 0./0;
+        if (std::strcmp(path, "-") == 0) {
+            return threads <= 1 ? runBatch(stdin, stdout, cacheCapacity)
+                                : ParallelBatch(threads, cacheCapacity).run(stdin, stdout);
         }
-        return fact(in - 1, acc * in);
-    }
-};
-
-class Double : public TreeNode {
-public:
-    double val;
-    explicit Double(double v) : TreeNode(), val(v) {};
-    [[nodiscard]] double eval() const override {
-        return val;
-    }
-    void print() const override {
-        std::cout << val;
-    }
-};
-
-class Identifier : public TreeNode {
-public:
-    const char* str;
-    int val;
-    explicit Identifier(const char* s, int v) : TreeNode(), str(s), val(v) {};
-    [[nodiscard]] double eval() const override {
-        return val;
-    }
-    void print() const override {
-        std::cout << str;
-    }
-};
-
-#define MAX_SIZE 30
-
-char nextToken;
-TreeNode* resultTree;
-char* pInput, *startInput;
-char nextIdentifier[MAX_SIZE];
-char nextDouble[MAX_SIZE];
-
-TreeNode* parseExp();
-TreeNode* parseTerm();
-TreeNode* parseTermVIP();
-TreeNode* parseFactor();
-
-bool isDigit(char in) {
-    return in >= '0' && in <= '9';
-}
-
-bool isLetter(char in) {
-    return in >= 'a' && in <= 'z' || in >= 'A' && in <= 'Z';
-}
-
-void scanToken() {
-    nextToken = *pInput;
-    // if next character is a digit
-    if (isDigit(nextToken)) {
-        int i = 0;
-        bool hasDigit = false;
-        while (isDigit(*pInput) || *pInput == '.') { // stop on encountering a non-digit
-            if (i == MAX_SIZE - 1) {
-                std::cout << "The number is too long.\n";
-                exit(-1);
-            }
-            if (*pInput == '.') {
-                if (hasDigit) {
-                    std::cout << "A number is not formatted.";
-                    exit(-1);
-                } else {
-                    hasDigit = true;
-                }
+        MappedFile in(path); // files are parsed in place rather than read through a buffer
+        if (!in.isOpen()) {
+            std::cout << "Cannot open " << path << ".\n";
+            return -1;
+        }
+        return threads <= 1 ? runBatch(in, stdout, cacheCapacity)
+                            : ParallelBatch(threads, cacheCapacity).run(in, stdout);
+    }
+    // --serve [--socket path] [--port N] [--threads N] [--cache N]: keeps answering the --batch line protocol
+    // on a Unix domain socket and/or TCP on 127.0.0.1 until interrupted
+    if (std::strcmp(argv[1], "--serve") == 0) {
+#ifdef SERVER_EPOLL
+        const char* socketPath = nullptr;
+        long port = -1;
+        unsigned threads = std::thread::hardware_concurrency();
+        size_t cacheCapacity = SERVER_DEFAULT_CACHE;
+        for (int i = 2; i + 1 < argc; i += 2) {
+            if (std::strcmp(argv[i], "--socket") == 0) {
+                socketPath = argv[i + 1];
+            } else if (std::strcmp(argv[i], "--port") == 0) {
+                port = atol(argv[i + 1]);
+            } else if (std::strcmp(argv[i], "--threads") == 0) {
+                threads = (unsigned) atoi(argv[i + 1]);
+            } else if (std::strcmp(argv[i], "--cache") == 0) {
+                cacheCapacity = (size_t) atol(argv[i + 1]);
             }
-            nextDouble[i++] = *pInput;
-            pInput++;
         }
-        nextDouble[i] = '\0';
-        return;
-    }
-    // if next character is +, -, *, /, (, ) or !
-    if (nextToken == '+' || nextToken == '-' || nextToken == '*' || nextToken == '/' ||
-        nextToken == '(' || nextToken == ')' || nextToken == '!' || nextToken == '^') {
-        pInput++;
-        return;
-    }
-    // otherwise, the next character is part of an Identifier (a string starting with a letter, consisting of letters and digits)
-    int i = 0;
-    do {
-        if (i == MAX_SIZE - 1) {
-            std::cout << "The identifier is too long.\n";
-            exit(-1);
+        if (socketPath == nullptr && (port < 0 || port > 65535)) {
+            std::cout << "Expected --socket path or --port N after --serve.\n";
+            return -1;
         }
-        nextIdentifier[i++] = *pInput;
-        pInput++;
-    } while (isDigit(*pInput) || isLetter(*pInput)); // stop on encountering a non-digit and non-letter
-    nextIdentifier[i] = '\0';
-}
-
-
-
-TreeNode* parseExp() {
-    TreeNode* a = parseTerm();
-    if (a == nullptr) {
-        return nullptr; // report error if parseTerm() fails
-    }
-    while (true) {
-        if (nextToken == '+') {
-            scanToken();
-            TreeNode* b = parseTerm();
-            if (b == nullptr) {
-                return nullptr; // report error if parseTerm() fails
-            }
-            a = new Add(a, b);
-        } else if (nextToken == '-') {
-            scanToken();
-            TreeNode* b = parseTerm();
-            if (b == nullptr) {
-                return nullptr; // report error if parseTerm() fails
-            }
-            a = new Sub(a, b);
-        } else {
-            return a;
+        static Server* server; // for the signal handler
+        Server s(threads, cacheCapacity);
+        if (socketPath != nullptr && !s.listenUnix(socketPath)) {
+            std::cout << "Cannot listen on " << socketPath << ": " << std::strerror(errno) << ".\n";
+            return -1;
         }
-    }
-}
-
-TreeNode* parseTerm() {
-    TreeNode* a = parseTermVIP(); // scan a factor
-    if (a == nullptr) {
-        return nullptr; // report error if parseFactor() fails
-    }
-    while (true) {
-        if (nextToken == '*') { // if nextToken is a '*' -> term: F * T
-            scanToken();
-            TreeNode* b = parseTermVIP();
-            if (b == nullptr) {
-                return nullptr; // report error if parseTerm() fails
-            }
-            a = new Mul(a, b);
-        } else if (nextToken == '/') { // if nextToken is a '/' -> term: F / T
-            scanToken();
-            TreeNode* b = parseTermVIP();
-            if (b == nullptr) {
-                return nullptr; // report error if parseTerm() fails
-            }
-            a = new Div(a, b);
-        } else { // otherwise -> term: F
-            return a;
+        if (port >= 0 && port <= 65535 && !s.listenTcp((uint16_t) port)) {
+            std::cout << "Cannot listen on port " << port << ": " << std::strerror(errno) << ".\n";
+            return -1;
         }
+        server = &s;
+        std::signal(SIGINT, [](int) { server->stop(); });
+        std::signal(SIGTERM, [](int) { server->stop(); });
+        return s.run();
+#else
+        std::cout << "Server mode needs Linux.\n";
+        return -1;
+#endif
     }
-
-}
-
-TreeNode* parseTermVIP() {
-    TreeNode* a = parseFactor();
-    if (a == nullptr) {
-        return nullptr;
-    }
-    while (true) {
-        if (nextToken == '^') {
-            scanToken();
-            TreeNode* b = parseFactor();
-            if (b == nullptr) {
-                return nullptr;
-            }
-            a = new Caret(a, b);
-        } else {
-            return a;
+    // --points [file|-] <expression>: the polynomial in one identifier at each number in the file, one result per line
+    if (std::strcmp(argv[1], "--points") == 0) {
+        if (argc < 4) {
+            std::cout << "Expected a file and an expression after --points.\n";
+            return -1;
         }
-    }
-}
-
-TreeNode* parseFactor() {
-    // if nextToken is an Identifier -> factor: Identifier
-    if (isLetter(nextToken)) {
-        scanToken();
-        return new Identifier(nextIdentifier, 0);
-    }
-    // if nextToken is an Double -> factor: Double
-    if (isDigit(nextToken)) {
-        scanToken();
-        TreeNode* a = new Double(atof(nextDouble));
-        while (true) {
-            if (nextToken == '!') {
-                scanToken();
-                a = new Factorial(a);
-            } else {
-                return a;
+        FILE* in = std::strcmp(argv[2], "-") == 0 ? stdin : fopen(argv[2], "rb");
+        if (in == nullptr) {
+            std::cout << "Cannot open " << argv[2] << ".\n";
+            return -1;
+        }
+        std::string text;
+        char buf[64 * 1024];
+        for (size_t n; (n = fread(buf, 1, sizeof buf, in)) > 0;) {
+            text.append(buf, n);
+        }
+        if (in != stdin) {
+            fclose(in);
+        }
+        std::vector<double> xs;
+        const char* p = text.c_str();
+        for (char* end;; p = end) { // numbers separated by blanks or line breaks
+            double x = strtod(p, &end);
+            if (end == p) {
+                break;
             }
+            xs.push_back(x);
         }
-    }
-    // if nextToken is a left parenthesis -> factor: (E)
-    if (nextToken == '(') {
-        scanToken();
-        TreeNode* a = parseExp();
-        if (a == nullptr) {
-            return nullptr; // report error if no expression found
+        std::string input;
+        for (int i = 3; i < argc; i++) {
+            input.append(argv[i]);
+        }
+        Parser parser;
+        TreeNode* tree = parser.parse(input.c_str());
+        if (tree == nullptr) {
+            std::cout << "Invalid input: " << parser.error().message << " at offset " << parser.error().offset << ".\n";
+            return -1;
+        }
+        MultipointEvaluator evaluator;
+        if (!evaluator.prepare(tree)) {
+            std::cout << "Cannot evaluate at points: " << evaluator.error() << ".\n";
+            return -1;
         }
-        if (nextToken == ')') {
-            scanToken();
-            while (true) {
-                if (nextToken == '!') {
-                    scanToken();
-                    a = new Factorial(a);
-                } else {
-                    return a;
-                }
+        std::vector<double> values(xs.size());
+        evaluator.eval(xs.data(), xs.size(), values.data());
+        std::string out;
+        for (double v : values) {
+            char num[32];
+            out.append(num, snprintf(num, sizeof num, "%g\n", v));
+        }
+        fwrite(out.data(), 1, out.size(), stdout);
+        return 0;
+    }
+    // --let name=value binds an identifier for this evaluation; unbound identifiers are 0
+    // --simplify prints and evaluates the tree after constant folding and simplification
+    // --expand prints and evaluates the expanded polynomial instead of the tree
+    // --gradient also prints the partial derivative for every identifier
+    int first = 1;
+    bool simplify = false;
+    bool expand = false;
+    bool gradient = false;
+    std::vector<const char*> lets;
+    while (first < argc) {
+        if (std::strcmp(argv[first], "--simplify") == 0) {
+            simplify = true;
+            first++;
+        } else if (std::strcmp(argv[first], "--expand") == 0) {
+            expand = true;
+            first++;
+        } else if (std::strcmp(argv[first], "--gradient") == 0) {
+            gradient = true;
+            first++;
+        } else if (std::strcmp(argv[first], "--let") == 0 && first + 1 < argc) {
+            if (std::strchr(argv[first + 1], '=') == nullptr) {
+                std::cout << "Expected name=value after --let.\n";
+                return -1;
             }
+            lets.push_back(argv[first + 1]);
+            first += 2;
+        } else {
+            break;
         }
-        return nullptr; // report error if no right parenthesis found
     }
-    // if nextToken is a minus sign -> factor: -F
-    if (nextToken == '-') {
-        scanToken();
-        return new Negate(parseFactor());
+    if (first == argc) {
+        std::cout << "Please input an expression.\n";
+        return -1;
+    }
+    std::string input;
+    for (int i = first; i < argc; i++) {
+        input.append(argv[i]);
     }
-    // report error if nextToken is anything else (+ | * | / etc.)
-    return nullptr;
-}
 
-int main(int argc, char** argv) {
-    if (argc == 1) {
-        std::cout << "Please pInput an expression.\n";
+    Parser parser;
+    TreeNode* resultTree = parser.parse(input.c_str());
+    if (resultTree == nullptr) { // points at the offending token below the expression
+        const ParseError& error = parser.error();
+        std::cout << "Invalid input: " << error.message << ".\n" << input << "\n"
+                  << std::string(error.offset, ' ') << "^\n";
         return -1;
     }
-    if (argc == 2) {
-        pInput = argv[1];
-    } else {
-        std::string a;
-        for (int i = 1; i < argc; i++) {
-            a.append(argv[i]);
+    if (simplify) {
+        resultTree = Simplifier(parser.arena()).simplify(resultTree);
+    }
+
+    const SymbolTable& symbols = parser.symbols();
+    std::vector<double> vars(symbols.size());
+    for (const char* let : lets) {
+        const char* eq = std::strchr(let, '=');
+        int64_t slot = symbols.lookup(std::string_view(let, eq - let));
+        if (slot >= 0) {
+            vars[slot] = atof(eq + 1);
         }
-        startInput = new char[a.size() + 1];
-        std::strcpy(startInput, a.c_str());
-        pInput = startInput;
     }
 
-    scanToken();
-    resultTree = parseExp();
-    if (resultTree == nullptr || nextToken != '\0') {
-        std::cout << "Invalid pInput.\n";
-        return -1;
+    if (expand) {
+        Expander expander;
+        if (!expander.expand(resultTree)) {
+            std::cout << "Cannot expand: " << expander.error() << ".\n";
+            return -1;
+        }
+        std::cout << expander.toString(symbols) << " = " << expander.eval(vars.data()) << "\n";
+        return 0;
     }
 
     resultTree->print();
     std::cout << " = ";
-    std::cout << resultTree->eval() << "\n";
-
-    delete[] startInput;
-    delete resultTree;
+    std::cout << resultTree->eval(vars.data()) << "\n";
+    if (gradient) {
+        std::vector<double> grad(symbols.size());
+        GradientEvaluator(resultTree).gradient(vars.data(), grad.data(), grad.size());
+        for (uint32_t slot = 0; slot < symbols.size(); slot++) {
+            std::cout << "d/d" << symbols.name(slot) << " = " << grad[slot] << "\n";
+        }
+    }
 }
-
-#pragma clang diagnostic pop
\ No newline at end of file
@@ -0,0 +1,105 @@
+#ifndef CALCULATOR_MAPPED_H
+#define CALCULATOR_MAPPED_H
+
+#include <cstddef>
+#include <cstdio>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MAPPED_FILE_MMAP
+#endif
+
+/* Read-only view of a whole input file. On POSIX systems a regular file is memory-mapped, so even a
+ * multi-gigabyte file is neither read up front nor copied: the parser works on its pages directly. Files that
+ * cannot be mapped (pipes, devices, empty files) and non-POSIX targets read the contents into memory instead.
+ * The contents are not null-terminated. Truncating the file while it is mapped makes later reads fault.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const char* path) {
+#ifdef MAPPED_FILE_MMAP
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+        opened = true;
+        struct stat st{};
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+            void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+#ifdef MADV_SEQUENTIAL
+                madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+#endif
+                mapping = p;
+                bytes = (const char*)p;
+                length = (size_t)st.st_size;
+                close(fd);
+                return;
+            }
+        }
+        char buf[1 << 16];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof buf)) > 0) {
+            contents.insert(contents.end(), buf, buf + n);
+        }
+        failed = n < 0;
+        close(fd);
+#else
+        FILE* f = fopen(path, "rb");
+        if (f == nullptr) {
+            return;
+        }
+        opened = true;
+        char buf[1 << 16];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof buf, f)) > 0) {
+            contents.insert(contents.end(), buf, buf + n);
+        }
+        failed = ferror(f) != 0;
+        fclose(f);
+#endif
+        bytes = contents.data();
+        length = contents.size();
+    }
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() {
+#ifdef MAPPED_FILE_MMAP
+        if (mapping != nullptr) {
+            munmap(mapping, length);
+        }
+#endif
+    }
+
+    // false if the file could not be opened
+    [[nodiscard]] bool isOpen() const {
+        return opened;
+    }
+
+    // true if reading the file failed part-way
+    [[nodiscard]] bool readFailed() const {
+        return failed;
+    }
+
+    [[nodiscard]] const char* data() const {
+        return bytes;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return length;
+    }
+
+private:
+    bool opened = false;
+    bool failed = false;
+    void* mapping = nullptr;
+    const char* bytes = nullptr;
+    size_t length = 0;
+    std::vector<char> contents; // used when the file is not mapped
+};
+
+#endif //CALCULATOR_MAPPED_H
@@ -0,0 +1,287 @@
+#ifndef CALCULATOR_MULTIPOINT_H
+#define CALCULATOR_MULTIPOINT_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "columns.h"
+#include "dense.h"
+#include "poly.h"
+
+#define MULTIPOINT_CHUNK 16384 // points per task when the work is spread over threads
+#define MULTIPOINT_LEAF 32 // subproduct trees end in blocks of this many points, evaluated by Horner's rule
+#define MULTIPOINT_NEWTON_MIN 64 // shorter quotients come from long division, longer ones from Newton inversion
+#define MULTIPOINT_MAX_DEGREE (1 << 24) // prepare() refuses polynomials whose coefficients would not fit in memory
+
+enum class MultipointMethod : uint8_t {
+    Horner, SubproductTree
+};
+
+/* Values of one polynomial at many points: out[i] = p(xs[i]). prepare() expands a parsed tree that uses at
+ * most one identifier into its coefficients with Expander, so the points are that identifier's values. Like
+ * --expand, this multiplies out products: (x-1)^40 near 1 loses digits that evaluating the tree keeps.
+ * - Horner: chunks of MULTIPOINT_CHUNK points are handed to threads through a shared counter and run through the
+ *   column kernel, which advances 16 points per multiply-add chain. O(n m) for n coefficients and m points,
+ *   with the accuracy of Horner's rule.
+ * - SubproductTree: the points are cut into groups of n. Per group, the products (x - x_a)...(x - x_b) over
+ *   halves, quarters, ... down to blocks of MULTIPOINT_LEAF points form a tree, p is reduced modulo them from
+ *   the root down (p mod M mod M' = p mod M' when M' divides M), and each block evaluates its remainder of degree
+ *   below MULTIPOINT_LEAF directly. Products, also those of the divisions by Newton inversion of the reversed
+ *   divisor, are Karatsuba and FFT products (dense.h), so a group costs O(n log^2 n) and all of them
+ *   O(m log^2 n); groups run in parallel. In floating point this is only as accurate as those products are
+ *   well-conditioned, and the coefficients of a product of many real linear factors grow exponentially with
+ *   their number and the points' magnitude, so its error is unbounded: remainders lose every digit to
+ *   cancellation unless the points are clustered tightly around 0 (|x| up to about 0.01 at degree 65535), and
+ *   for points spread over [-1, 1] the values can be off by any amount. It fails, returning false, only when a
+ *   product, remainder or value is not finite.
+ * Against the vectorized Horner kernel the tree only breaks even around degree 65536, and nothing short of
+ * evaluating every point again bounds its error, so it is only used when asked for.
+ */
+class MultipointEvaluator {
+public:
+    explicit MultipointEvaluator(unsigned threads = std::thread::hardware_concurrency())
+            : threads(threads == 0 ? 1 : threads) {}
+
+    // false if the tree is not a polynomial in at most one identifier of degree up to MULTIPOINT_MAX_DEGREE,
+    // see error()
+    bool prepare(const TreeNode* root) {
+        Expander expander;
+        if (!expander.expand(root)) {
+            reason = expander.error();
+            return false;
+        }
+        const Polynomial& p = expander.polynomial();
+        if (p.monomials().vars > 1) {
+            reason = "more than one variable";
+            return false;
+        }
+        if (p.monomials().vars == 1 && p.degree(0) > MULTIPOINT_MAX_DEGREE) {
+            reason = "degree too large";
+            return false;
+        }
+        coefs = p.size() == 0 ? std::vector<double>{0} : p.monomials().vars == 0
+                                                          ? std::vector<double>{p.constantValue()} : p.dense();
+        reason = "";
+        return true;
+    }
+
+    // why the last prepare() failed
+    [[nodiscard]] const char* error() const {
+        return reason;
+    }
+
+    // coefficients by increasing exponent
+    [[nodiscard]] const std::vector<double>& coefficients() const {
+        return coefs;
+    }
+
+    // out[i] = p(xs[i]) for i in [0, m); false only if the subproduct tree overflowed, see above for its error
+    bool eval(const double* xs, size_t m, double* out, MultipointMethod method = MultipointMethod::Horner) {
+        if (method == MultipointMethod::SubproductTree) {
+            return evalTree(xs, m, out);
+        }
+        evalHorner(xs, m, out);
+        return true;
+    }
+
+private:
+    unsigned threads;
+    std::vector<double> coefs{0};
+    const char* reason = "";
+
+    struct ProductNode {
+        std::vector<double> product; // monic, of the node's points as roots
+        size_t begin; // first point, relative to the group
+        size_t count;
+        size_t left; // child nodes, unused for a block
+        size_t right;
+    };
+
+    // calls task(i) for every i in [0, tasks) on up to threads threads
+    template<class Task>
+    void parallelFor(size_t tasks, Task task) const {
+        std::atomic<size_t> next{0};
+        auto work = [&] {
+            for (size_t i = next++; i < tasks; i = next++) {
+                task(i);
+            }
+        };
+        size_t n = std::min<size_t>(threads, tasks);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < n; i++) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    void evalHorner(const double* xs, size_t m, double* out) const {
+        const ColumnKernels& k = columnKernels();
+        parallelFor((m + MULTIPOINT_CHUNK - 1) / MULTIPOINT_CHUNK, [&](size_t chunk) {
+            size_t begin = chunk * MULTIPOINT_CHUNK;
+            size_t n = std::min<size_t>(MULTIPOINT_CHUNK, m - begin);
+            std::memcpy(out + begin, xs + begin, n * sizeof(double));
+            k.horner(out + begin, coefs.data(), (uint32_t)(coefs.size() - 1), n);
+        });
+    }
+
+    bool evalTree(const double* xs, size_t m, double* out) const {
+        if (!isFinite(coefs.data(), coefs.size())) {
+            return false;
+        }
+        size_t group = std::max<size_t>(coefs.size(), MULTIPOINT_LEAF);
+        std::atomic<bool> ok{true};
+        parallelFor((m + group - 1) / group, [&](size_t g) {
+            size_t begin = g * group;
+            if (ok && !evalGroup(xs + begin, std::min(group, m - begin), out + begin)) {
+                ok = false;
+            }
+        });
+        return ok;
+    }
+
+    bool evalGroup(const double* x, size_t k, double* out) const {
+        std::vector<ProductNode> nodes;
+        if (!build(x, 0, k, nodes)) {
+            return false;
+        }
+        // the root is built last; its remainder is p itself unless there are more coefficients than points
+        std::vector<std::vector<double>> pending{remainder(coefs, nodes.back().product)};
+        std::vector<size_t> at{nodes.size() - 1};
+        while (!at.empty()) {
+            const ProductNode& node = nodes[at.back()];
+            std::vector<double> r = std::move(pending.back());
+            at.pop_back();
+            pending.pop_back();
+            if (!isFinite(r.data(), r.size())) { // the divisions overflowed
+                return false;
+            }
+            if (node.count <= MULTIPOINT_LEAF) {
+                for (size_t i = 0; i < node.count; i++) {
+                    out[node.begin + i] = hornerKernel()(r.data(), (uint32_t)(r.size() - 1), x[node.begin + i]);
+                }
+                if (!isFinite(out + node.begin, node.count)) {
+                    return false;
+                }
+                continue;
+            }
+            pending.push_back(remainder(r, nodes[node.right].product));
+            at.push_back(node.right);
+            pending.push_back(remainder(r, nodes[node.left].product));
+            at.push_back(node.left);
+        }
+        return true;
+    }
+
+    // appends the subtree of points [begin, begin + count) to nodes, children before parents; false on overflow
+    static bool build(const double* x, size_t begin, size_t count, std::vector<ProductNode>& nodes) {
+        ProductNode node{{}, begin, count, 0, 0};
+        if (count <= MULTIPOINT_LEAF) {
+            node.product = {1};
+            for (size_t i = begin; i < begin + count; i++) { // times (t - x_i)
+                node.product.push_back(0);
+                for (size_t j = node.product.size() - 1; j > 0; j--) {
+                    node.product[j] = node.product[j - 1] - x[i] * node.product[j];
+                }
+                node.product[0] *= -x[i];
+            }
+        } else {
+            size_t half = count / 2;
+            if (!build(x, begin, half, nodes)) {
+                return false;
+            }
+            node.left = nodes.size() - 1;
+            if (!build(x, begin + half, count - half, nodes)) {
+                return false;
+            }
+            node.right = nodes.size() - 1;
+            node.product = product(nodes[node.left].product, nodes[node.right].product);
+        }
+        if (!isFinite(node.product.data(), node.product.size())) {
+            return false;
+        }
+        nodes.push_back(std::move(node));
+        return true;
+    }
+
+    static bool isFinite(const double* v, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            if (!std::isfinite(v[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Karatsuba or FFT without the direct recomputation of small results that multiplyDense() may fall back to
+    // schoolbook for: that would make the tree quadratic
+    static std::vector<double> product(const std::vector<double>& a, const std::vector<double>& b) {
+        size_t n = a.size(), m = b.size();
+        std::vector<double> out(n + m - 1);
+        if (std::min(n, m) < DENSE_KARATSUBA_MIN) {
+            multiplySchoolbook(a.data(), n, b.data(), m, out.data());
+        } else if (std::min(n, m) < DENSE_FFT_MIN) {
+            multiplyKaratsuba(a.data(), n, b.data(), m, out.data());
+        } else {
+            multiplyFft(a.data(), n, b.data(), m, out.data());
+        }
+        return out;
+    }
+
+    // a mod b for a monic b
+    static std::vector<double> remainder(const std::vector<double>& a, const std::vector<double>& b) {
+        size_t d = b.size() - 1;
+        if (a.size() <= d) {
+            return a;
+        }
+        size_t k = a.size() - d; // coefficients of the quotient
+        std::vector<double> r(a);
+        if (k < MULTIPOINT_NEWTON_MIN || d < MULTIPOINT_NEWTON_MIN) { // long division
+            for (size_t i = a.size(); i-- > d;) {
+                double q = r[i];
+                for (size_t j = 0; j < d; j++) {
+                    r[i - d + j] -= q * b[j];
+                }
+            }
+            r.resize(d);
+            return r;
+        }
+        // reversed, a = q b + r reads rev(a) = rev(q) rev(b) mod t^k, and rev(b) starts with 1 so it is invertible
+        std::vector<double> revA(a.rbegin(), a.rbegin() + k), revB(b.rbegin(), b.rend());
+        std::vector<double> q = product(revA, inverse(revB, k));
+        q.resize(k);
+        std::reverse(q.begin(), q.end());
+        std::vector<double> qb = product(q, b);
+        for (size_t j = 0; j < d; j++) {
+            r[j] -= qb[j];
+        }
+        r.resize(d);
+        return r;
+    }
+
+    // the power series g with f g = 1 mod t^k, for f[0] = 1, by Newton's iteration g' = g (2 - f g)
+    static std::vector<double> inverse(const std::vector<double>& f, size_t k) {
+        std::vector<double> g{1};
+        for (size_t n = 1; n < k;) {
+            n = std::min(2 * n, k);
+            std::vector<double> e = product(std::vector<double>(f.begin(), f.begin() + std::min(n, f.size())), g);
+            e.resize(n);
+            for (double& c : e) {
+                c = -c;
+            }
+            e[0] += 2;
+            g = product(g, e);
+            g.resize(n);
+        }
+        return g;
+    }
+};
+
+#endif //CALCULATOR_MULTIPOINT_H
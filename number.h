@@ -0,0 +1,80 @@
+#ifndef CALCULATOR_NUMBER_H
+#define CALCULATOR_NUMBER_H
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+
+#define NUMBER_FAST_DIGITS 19 // significant digits that always fit in a uint64_t
+#define NUMBER_FAST_MAX_POW10 22 // 10^22 is the largest power of ten that is exact in a double
+
+/* Scans and converts a number literal: digits [. digits] [(e | E) [+ | -] digits], e.g. 12, 0.5, 5. or 1e-9.
+ * Most literals take the fast path: when the significant digits fit in 53 bits and the decimal exponent is
+ * within +-22, both are exact doubles and a single multiplication or division rounds correctly (Clinger's
+ * fast path). Everything else, e.g. 20 significant digits or 1e300, goes through std::from_chars, which is
+ * correctly rounded too. No copies, no locale, no length limit.
+ * p must point at a digit; returns the end of the literal and stores its value.
+ */
+inline const char* scanNumber(const char* p, const char* end, double& value) {
+    static const double powers[NUMBER_FAST_MAX_POW10 + 1] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    auto isDigit = [](char c) { return c >= '0' && c <= '9'; };
+    const char* start = p;
+    uint64_t mantissa = 0;
+    int digits = 0; // significant digits in mantissa
+    int64_t exponent = 0;
+    bool truncated = false; // nonzero digits beyond NUMBER_FAST_DIGITS were dropped
+    for (; p != end && isDigit(*p); p++) {
+        if (digits < NUMBER_FAST_DIGITS) {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits += mantissa != 0; // leading zeros are not significant
+        } else {
+            truncated |= *p != '0';
+            exponent++;
+        }
+    }
+    if (p != end && *p == '.') {
+        for (p++; p != end && isDigit(*p); p++) {
+            if (digits < NUMBER_FAST_DIGITS) {
+                mantissa = mantissa * 10 + (*p - '0');
+                digits += mantissa != 0;
+                exponent--;
+            } else {
+                truncated |= *p != '0';
+            }
+        }
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) { // only an exponent if digits follow, otherwise 'e' is not ours
+        const char* q = p + 1;
+        bool negative = q != end && *q == '-';
+        if (q != end && (*q == '+' || *q == '-')) {
+            q++;
+        }
+        if (q != end && isDigit(*q)) {
+            int64_t e = 0;
+            for (; q != end && isDigit(*q); q++) {
+                if (e < 1000000) { // anything beyond over- or underflows anyway
+                    e = e * 10 + (*q - '0');
+                }
+            }
+            exponent += negative ? -e : e;
+            p = q;
+        }
+    }
+    if (mantissa == 0) {
+        value = 0;
+        return p;
+    }
+    if (!truncated && mantissa <= (uint64_t)1 << 53 && exponent >= -NUMBER_FAST_MAX_POW10 &&
+        exponent <= NUMBER_FAST_MAX_POW10) {
+        value = exponent < 0 ? (double)mantissa / powers[-exponent] : (double)mantissa * powers[exponent];
+        return p;
+    }
+    if (std::from_chars(start, p, value).ec == std::errc::result_out_of_range) {
+        value = digits + exponent > 0 ? HUGE_VAL : 0; // magnitude ~10^(digits + exponent - 1)
+    }
+    return p;
+}
+
+#endif //CALCULATOR_NUMBER_H
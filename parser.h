@@ -0,0 +1,335 @@
+#ifndef CALCULATOR_PARSER_H
+#define CALCULATOR_PARSER_H
+
+/* Syntax:
+ *      Expression: T {+ | - T}
+ *      Term: TV {* | / TV}
+ *      TermVIP: F {^ F}
+ *      Factor: Identifier | Double | (E) | -F | F!
+ *      Double: digits [. digits] [(e | E) [+ | -] digits]
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <vector>
+
+#include "tree.h"
+#include "symbols.h"
+#include "arena.h"
+#include "dag.h"
+#include "number.h"
+#include "classify.h"
+
+#define CLASSIFY_MIN_LENGTH (64 * 1024) // shorter inputs are lexed byte by byte, the pre-pass would not pay off
+
+enum class ParseErrorCode : uint8_t {
+    None,
+    UnexpectedEnd, // the input ends where a factor is expected
+    UnexpectedToken, // an operator where a factor is expected, or a misplaced !
+    InvalidCharacter, // a character that starts no token
+    UnmatchedParenthesis, // a ) without an open (
+    MissingParenthesis, // an ( still open at the end of the expression
+    TrailingInput, // a factor directly after a complete expression, e.g. 2 3
+};
+
+// why and where the last parse() failed; message is static text, so reporting an error allocates nothing
+struct ParseError {
+    ParseErrorCode code = ParseErrorCode::None;
+    size_t offset = 0; // in bytes from the start of the input, at the token that could not be used
+    const char* message = "";
+};
+
+/* Lexer and operator-precedence parser. All state lives in the instance, so one Parser per thread is safe.
+ * The parser owns the arena its trees are built in and the symbol table their identifiers are bound to;
+ * slots stay stable for the parser's lifetime, while a tree is only valid until the next parse().
+ * The lexer never copies the input: numbers are converted where they lie by scanNumber() and an identifier is
+ * a view that is only copied once, by the symbol table, so literals and names have no length limit.
+ * Long inputs are classified up front into CharClasses bitmaps that blanks and identifiers are skipped with.
+ * Pending operators and operands are kept on explicit stacks instead of the native one, so nesting depth is
+ * bounded by memory and parsing stays linear in the input.
+ */
+class Parser {
+public:
+    // returns nullptr if input is not a complete expression, see error() for the reason
+    TreeNode* parse(const char* input) {
+        return parse(input, input + std::strlen(input));
+    }
+
+    // [begin, end) need not be null-terminated, e.g. a line of a memory-mapped file
+    TreeNode* parse(const char* begin, const char* end) {
+        nodeArena.reset();
+        nodeTable.clear();
+        lastError.code = ParseErrorCode::None;
+        start(begin, end);
+        scanToken();
+        TreeNode* tree = parseExp();
+        if (tree != nullptr && nextToken != '\0') {
+            return fail(nextToken == '!' ? ParseErrorCode::UnexpectedToken : ParseErrorCode::TrailingInput,
+                        nextToken == '!' ? "misplaced !"
+                                         : "expected an operator");
+        }
+        return tree;
+    }
+
+    // the reason the last parse() returned nullptr; code is None after a successful parse
+    [[nodiscard]] const ParseError& error() const {
+        return lastError;
+    }
+
+    // with hash-consing on, structurally identical subtrees of one expression are built as a single shared node
+    void setHashConsing(bool on) {
+        hashConsing = on;
+    }
+
+    // runs only the lexer over input and returns the number of tokens, for measuring it in isolation
+    size_t countTokens(const char* input) {
+        size_t n = 0;
+        start(input, input + std::strlen(input));
+        for (scanToken(); nextToken != '\0'; scanToken()) {
+            n++;
+        }
+        return n;
+    }
+
+    [[nodiscard]] SymbolTable& symbols() {
+        return symbolTable;
+    }
+
+    [[nodiscard]] const SymbolTable& symbols() const {
+        return symbolTable;
+    }
+
+    // passes that rewrite a parsed tree allocate the new nodes here, so they share its lifetime
+    [[nodiscard]] Arena& arena() {
+        return nodeArena;
+    }
+
+private:
+    char nextToken = '\0';
+    const char* tokenBegin = nullptr; // first character of the current token
+    const char* pBegin = nullptr;
+    const char* pInput = nullptr;
+    const char* pEnd = nullptr;
+    bool classified = false; // whether classes describes [pBegin, pEnd)
+    CharClasses classes;
+    std::string_view token; // text of the current Identifier token, viewing the input
+    double number = 0; // value of the current Double token
+    SymbolTable symbolTable;
+    Arena nodeArena; // owns every node of the expression being parsed
+    bool hashConsing = false;
+    NodeTable nodeTable;
+    std::vector<TreeNode*> operands; // parse stacks, reused between expressions
+    std::vector<char> operators; // + - * / ^, ( for an open parenthesis, ~ for a unary minus
+    ParseError lastError;
+
+    template<class T>
+    TreeNode* makeInfix(NodeKind kind, TreeNode* l, TreeNode* r) {
+        if (!hashConsing) {
+            return nodeArena.make<T>(l, r);
+        }
+        return nodeTable.intern(infixKey(kind, l, r), [&] { return nodeArena.make<T>(l, r); });
+    }
+
+    template<class T>
+    TreeNode* makeUnary(NodeKind kind, TreeNode* a) {
+        if (!hashConsing) {
+            return nodeArena.make<T>(a);
+        }
+        return nodeTable.intern(infixKey(kind, a, nullptr), [&] { return nodeArena.make<T>(a); });
+    }
+
+    static bool isDigit(char in) {
+        return in >= '0' && in <= '9';
+    }
+
+    static bool isLetter(char in) {
+        return (in >= 'a' && in <= 'z') || (in >= 'A' && in <= 'Z');
+    }
+
+    static bool isSpace(char in) {
+        return in == ' ' || in == '\t' || in == '\r';
+    }
+
+    static bool isOperator(char in) {
+        return in == '+' || in == '-' || in == '*' || in == '/' || in == '(' || in == ')' || in == '!' || in == '^';
+    }
+
+    // records an error at the current token; an unknown character is reported as such whatever was expected
+    TreeNode* fail(ParseErrorCode code, const char* message) {
+        if (nextToken != '\0' && !isOperator(nextToken) && !isDigit(nextToken) && !isLetter(nextToken)) {
+            code = ParseErrorCode::InvalidCharacter;
+            message = "invalid character";
+        }
+        lastError = {code, (size_t)(tokenBegin - pBegin), message};
+        return nullptr;
+    }
+
+    void start(const char* begin, const char* end) {
+        pBegin = pInput = begin;
+        pEnd = end;
+        classified = end - begin >= CLASSIFY_MIN_LENGTH;
+        if (classified) {
+            classes.build(begin, end);
+        }
+    }
+
+    void scanToken() {
+        if (pInput != pEnd && isSpace(*pInput)) { // most tokens follow no blank at all
+            if (classified) {
+                pInput = pBegin + classes.skipSpace(pInput + 1 - pBegin);
+            } else {
+                while (pInput != pEnd && isSpace(*pInput)) {
+                    pInput++;
+                }
+            }
+        }
+        tokenBegin = pInput;
+        if (pInput == pEnd) { // end of input, stay there
+            nextToken = '\0';
+            return;
+        }
+        nextToken = *pInput;
+        // if next character is a digit
+        if (isDigit(nextToken)) {
+            pInput = scanNumber(pInput, pEnd, number);
+            return;
+        }
+        // if next character is +, -, *, /, (, ) or !
+        if (isOperator(nextToken)) {
+            pInput++;
+            return;
+        }
+        // otherwise, the next character is part of an Identifier (a string starting with a letter, consisting of letters and digits)
+        const char* first = pInput;
+        pInput++;
+        if (classified && pInput != pEnd && (isDigit(*pInput) || isLetter(*pInput))) {
+            pInput = pBegin + classes.skipWord(pInput - pBegin);
+        } else {
+            while (pInput != pEnd && (isDigit(*pInput) || isLetter(*pInput))) { // stop on encountering a non-digit and non-letter
+                pInput++;
+            }
+        }
+        token = std::string_view(first, pInput - first);
+    }
+
+    static int precedence(char op) {
+        switch (op) {
+            case '+':
+            case '-':
+                return 1;
+            case '*':
+            case '/':
+                return 2;
+            case '^':
+                return 3;
+            default: // ( and ~ are not binary operators, reducing stops there
+                return 0;
+        }
+    }
+
+    // pops the top operator and its two operands and pushes the infix node
+    void reduce() {
+        char op = operators.back();
+        operators.pop_back();
+        TreeNode* b = operands.back();
+        operands.pop_back();
+        TreeNode* a = operands.back();
+        switch (op) {
+            case '+':
+                a = makeInfix<Add>(NodeKind::Add, a, b);
+                break;
+            case '-':
+                a = makeInfix<Sub>(NodeKind::Sub, a, b);
+                break;
+            case '*':
+                a = makeInfix<Mul>(NodeKind::Mul, a, b);
+                break;
+            case '/':
+                a = makeInfix<Div>(NodeKind::Div, a, b);
+                break;
+            default:
+                a = makeInfix<Caret>(NodeKind::Caret, a, b);
+                break;
+        }
+        operands.back() = a;
+    }
+
+    // F! and -F: a factorial binds to the number or (E) before it, then pending unary minuses apply to the factor
+    TreeNode* finishFactor(TreeNode* a, bool factorialAllowed) {
+        while (factorialAllowed && nextToken == '!') {
+            scanToken();
+            a = makeUnary<Factorial>(NodeKind::Factorial, a);
+        }
+        while (!operators.empty() && operators.back() == '~') {
+            operators.pop_back();
+            a = makeUnary<Negate>(NodeKind::Negate, a);
+        }
+        return a;
+    }
+
+    // ^ binds tighter than * and /, which bind tighter than + and -; all of them are left-associative
+    TreeNode* parseExp() {
+        operands.clear();
+        operators.clear();
+        while (true) {
+            // a factor: any number of unary minuses and left parentheses, then an Identifier or a Double
+            while (nextToken == '-' || nextToken == '(') {
+                operators.push_back(nextToken == '-' ? '~' : '(');
+                scanToken();
+            }
+            if (isLetter(nextToken)) { // factor: Identifier
+                uint32_t slot = symbolTable.intern(token); // before scanToken() moves on
+                scanToken();
+                TreeNode* a;
+                if (!hashConsing) {
+                    a = nodeArena.make<Identifier>(symbolTable.name(slot).c_str(), slot);
+                } else {
+                    a = nodeTable.intern({NodeKind::Identifier, slot, 0}, [&] {
+                        return nodeArena.make<Identifier>(symbolTable.name(slot).c_str(), slot);
+                    });
+                }
+                operands.push_back(finishFactor(a, false));
+            } else if (isDigit(nextToken)) { // factor: Double
+                double v = number;
+                scanToken();
+                TreeNode* a = hashConsing ? nodeTable.intern(constantKey(v), [&] { return nodeArena.make<Double>(v); })
+                                          : nodeArena.make<Double>(v);
+                operands.push_back(finishFactor(a, true));
+            } else if (nextToken == '\0') {
+                return fail(ParseErrorCode::UnexpectedEnd, "unexpected end of input");
+            } else { // + * / ) ! ^ or a character that starts no token
+                return fail(ParseErrorCode::UnexpectedToken, "expected a number, an identifier, - or (");
+            }
+            // every right parenthesis closes a factor: (E)
+            while (nextToken == ')') {
+                while (!operators.empty() && operators.back() != '(') {
+                    reduce();
+                }
+                if (operators.empty()) {
+                    return fail(ParseErrorCode::UnmatchedParenthesis, "unmatched )");
+                }
+                operators.pop_back();
+                scanToken();
+                operands.back() = finishFactor(operands.back(), true);
+            }
+            int p = precedence(nextToken);
+            if (p == 0) { // end of the expression
+                while (!operators.empty()) {
+                    if (operators.back() == '(') {
+                        return fail(ParseErrorCode::MissingParenthesis, "missing )");
+                    }
+                    reduce();
+                }
+                return operands.back();
+            }
+            while (!operators.empty() && precedence(operators.back()) >= p) {
+                reduce();
+            }
+            operators.push_back(nextToken);
+            scanToken();
+        }
+    }
+};
+
+#endif //CALCULATOR_PARSER_H
@@ -0,0 +1,672 @@
+#ifndef CALCULATOR_POLY_H
+#define CALCULATOR_POLY_H
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tree.h"
+#include "symbols.h"
+#include "dense.h"
+
+#define POLY_MAX_VARS 32 // every variable needs at least a value bit and a guard bit of the 64-bit key
+#define POLY_MAX_TERMS (1 << 24) // a product with more terms than this is refused rather than exhausting memory
+#define POLY_MAX_POWER 1000000 // largest exponent of ^ applied to a non-constant polynomial
+#define POLY_DENSE_RATIO 4 // a univariate operand with more than 1 / POLY_DENSE_RATIO of its coefficients is dense
+
+/* Exponent vectors packed into one 64-bit key. Each of vars variables gets a field of bits = 64 / vars bits,
+ * variable 0 in the highest one, so comparing keys orders monomials lexicographically and multiplying two
+ * monomials adds their keys. The top bit of every field is a guard that stays clear in a valid key: products
+ * are checked to keep exponents below 2^(bits - 1), so adding two keys never carries into the next field.
+ */
+struct MonomialLayout {
+    uint32_t vars = 0;
+    uint32_t bits = 64;
+
+    MonomialLayout() = default;
+
+    explicit MonomialLayout(uint32_t vars) : vars(vars), bits(vars == 0 ? 64 : 64 / vars) {}
+
+    [[nodiscard]] uint32_t shift(uint32_t var) const {
+        return 64 - bits * (var + 1);
+    }
+
+    // the monomial of variable var to the first power
+    [[nodiscard]] uint64_t variable(uint32_t var) const {
+        return (uint64_t)1 << shift(var);
+    }
+
+    [[nodiscard]] uint64_t exponent(uint64_t key, uint32_t var) const {
+        return key >> shift(var) & maxExponent();
+    }
+
+    [[nodiscard]] uint64_t maxExponent() const {
+        return ((uint64_t)1 << (bits - 1)) - 1;
+    }
+
+    [[nodiscard]] uint64_t degree(uint64_t key) const {
+        uint64_t d = 0;
+        for (uint32_t i = 0; i < vars; i++) {
+            d += exponent(key, i);
+        }
+        return d;
+    }
+};
+
+struct Term {
+    uint64_t key; // packed exponents, see MonomialLayout
+    double coef;
+};
+
+// accumulates coefficients per monomial; open addressing with linear probing, like NodeTable
+class TermMap {
+public:
+    explicit TermMap(size_t expected) {
+        size_t size = 16;
+        while (size < expected * 2) {
+            size *= 2;
+        }
+        slots.assign(size, Term{EMPTY, 0});
+    }
+
+    // false once the map would hold more than POLY_MAX_TERMS monomials
+    bool add(uint64_t key, double coef) {
+        size_t mask = slots.size() - 1;
+        for (size_t i = hash(key) & mask;; i = (i + 1) & mask) {
+            Term& t = slots[i];
+            if (t.key == key) {
+                t.coef += coef;
+                return true;
+            }
+            if (t.key == EMPTY) {
+                t = {key, coef};
+                if (++count * 2 > slots.size()) {
+                    if (count > POLY_MAX_TERMS) {
+                        return false;
+                    }
+                    grow();
+                }
+                return true;
+            }
+        }
+    }
+
+    // appends the monomials whose coefficients did not cancel out
+    void collect(std::vector<Term>& out) const {
+        out.reserve(out.size() + count);
+        for (const Term& t : slots) {
+            if (t.key != EMPTY && t.coef != 0) {
+                out.push_back(t);
+            }
+        }
+    }
+
+private:
+    static constexpr uint64_t EMPTY = ~(uint64_t)0; // has every guard bit set, so it is never a valid key
+
+    std::vector<Term> slots;
+    size_t count = 0;
+
+    static size_t hash(uint64_t key) {
+        uint64_t h = key * 0x9E3779B97F4A7C15ull;
+        return (size_t)(h ^ h >> 29);
+    }
+
+    void grow() {
+        std::vector<Term> old = std::move(slots);
+        slots.assign(old.size() * 2, Term{EMPTY, 0});
+        size_t mask = slots.size() - 1;
+        for (const Term& t : old) {
+            if (t.key != EMPTY) {
+                size_t i = hash(t.key) & mask;
+                while (slots[i].key != EMPTY) {
+                    i = (i + 1) & mask;
+                }
+                slots[i] = t;
+            }
+        }
+    }
+};
+
+enum class PolyStatus {
+    Ok,
+    ExponentOverflow, // an exponent would not fit its field of the key
+    TooManyTerms, // the result would have more than POLY_MAX_TERMS terms
+    CoefficientOverflow, // a product of finite coefficients is not finite
+};
+
+/* Sparse multivariate polynomial in canonical form: one term per distinct monomial, no zero coefficients.
+ * Terms are kept in no particular order; sorted() gives graded lexicographic order for printing.
+ * Sums merge terms through a TermMap in time linear in the number of terms, products accumulate every pair of
+ * terms into one, and integer powers square repeatedly. Products of dense univariate polynomials go through
+ * multiplyDense() instead, which takes them from quadratic to O(n log n) time.
+ */
+class Polynomial {
+public:
+    explicit Polynomial(MonomialLayout layout) : layout(layout) {}
+
+    static Polynomial constant(MonomialLayout layout, double c) {
+        Polynomial p(layout);
+        if (c != 0) {
+            p.terms.push_back({0, c});
+        }
+        return p;
+    }
+
+    static Polynomial variable(MonomialLayout layout, uint32_t var) {
+        Polynomial p(layout);
+        p.terms.push_back({layout.variable(var), 1});
+        return p;
+    }
+
+    [[nodiscard]] const MonomialLayout& monomials() const {
+        return layout;
+    }
+
+    [[nodiscard]] size_t size() const {
+        return terms.size();
+    }
+
+    [[nodiscard]] bool isConstant() const {
+        return terms.empty() || (terms.size() == 1 && terms[0].key == 0);
+    }
+
+    // the value of a constant polynomial
+    [[nodiscard]] double constantValue() const {
+        return terms.empty() ? 0 : terms[0].coef;
+    }
+
+    // highest exponent of var in any term
+    [[nodiscard]] uint64_t degree(uint32_t var) const {
+        uint64_t d = 0;
+        for (const Term& t : terms) {
+            d = std::max(d, layout.exponent(t.key, var));
+        }
+        return d;
+    }
+
+    [[nodiscard]] Polynomial plus(const Polynomial& other, double sign = 1) const {
+        TermMap sum(terms.size() + other.terms.size());
+        for (const Term& t : terms) {
+            sum.add(t.key, t.coef);
+        }
+        for (const Term& t : other.terms) {
+            sum.add(t.key, sign * t.coef);
+        }
+        Polynomial p(layout);
+        sum.collect(p.terms);
+        return p;
+    }
+
+    [[nodiscard]] Polynomial minus(const Polynomial& other) const {
+        return plus(other, -1);
+    }
+
+    // adds sign times every term to sum, for sums of many polynomials; false if sum outgrew POLY_MAX_TERMS
+    bool addTo(TermMap& sum, double sign = 1) const {
+        for (const Term& t : terms) {
+            if (!sum.add(t.key, sign * t.coef)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static Polynomial fromSum(MonomialLayout layout, const TermMap& sum) {
+        Polynomial p(layout);
+        sum.collect(p.terms);
+        return p;
+    }
+
+    [[nodiscard]] Polynomial scaled(double c) const {
+        Polynomial p(layout);
+        if (c != 0) {
+            p.terms = terms;
+            for (Term& t : p.terms) {
+                t.coef *= c;
+            }
+        }
+        return p;
+    }
+
+    static PolyStatus multiply(const Polynomial& a, const Polynomial& b, Polynomial& out) {
+        for (uint32_t i = 0; i < a.layout.vars; i++) {
+            if (!a.terms.empty() && !b.terms.empty() && a.degree(i) + b.degree(i) > a.layout.maxExponent()) {
+                return PolyStatus::ExponentOverflow;
+            }
+        }
+        // overflow is an error rather than carried along: infinite coefficients keep the product off the
+        // dense path, so every power after the first overflow would take quadratic time
+        bool finite = a.isFinite() && b.isFinite();
+        if (a.layout.vars == 1 && finite && a.isDense() && b.isDense()) {
+            std::vector<double> c = multiplyDense(a.dense(), b.dense());
+            out = Polynomial(a.layout);
+            for (size_t e = 0; e < c.size(); e++) {
+                if (c[e] != 0) {
+                    out.terms.push_back({e << a.layout.shift(0), c[e]});
+                }
+            }
+            if (out.terms.size() > POLY_MAX_TERMS) {
+                return PolyStatus::TooManyTerms;
+            }
+            return out.isFinite() ? PolyStatus::Ok : PolyStatus::CoefficientOverflow;
+        }
+        TermMap product(std::max(a.terms.size(), b.terms.size()));
+        for (const Term& s : a.terms) {
+            for (const Term& t : b.terms) {
+                if (!product.add(s.key + t.key, s.coef * t.coef)) {
+                    return PolyStatus::TooManyTerms;
+                }
+            }
+        }
+        out = Polynomial(a.layout);
+        product.collect(out.terms);
+        return finite && !out.isFinite() ? PolyStatus::CoefficientOverflow : PolyStatus::Ok;
+    }
+
+    static PolyStatus power(const Polynomial& a, uint64_t e, Polynomial& out) {
+        if (a.terms.size() == 1) { // a monomial such as 3*x^2: multiply the exponents directly
+            Term t = a.terms[0];
+            Polynomial p(a.layout);
+            for (uint32_t i = 0; i < a.layout.vars; i++) {
+                uint64_t d = a.layout.exponent(t.key, i);
+                if (d != 0 && e > a.layout.maxExponent() / d) {
+                    return PolyStatus::ExponentOverflow;
+                }
+            }
+            double c = std::pow(t.coef, (double)e);
+            if (std::isfinite(t.coef) && !std::isfinite(c)) {
+                return PolyStatus::CoefficientOverflow;
+            }
+            if (c != 0) { // underflow
+                p.terms.push_back({t.key * e, c});
+            }
+            out = std::move(p);
+            return PolyStatus::Ok;
+        }
+        Polynomial result = constant(a.layout, 1);
+        Polynomial base = a;
+        while (true) {
+            if (e & 1) {
+                PolyStatus s = multiply(result, base, result);
+                if (s != PolyStatus::Ok) {
+                    return s;
+                }
+            }
+            e >>= 1;
+            if (e == 0) {
+                break;
+            }
+            PolyStatus s = multiply(base, base, base);
+            if (s != PolyStatus::Ok) {
+                return s;
+            }
+        }
+        out = std::move(result);
+        return PolyStatus::Ok;
+    }
+
+    // values are indexed by variable, not by symbol slot
+    [[nodiscard]] double eval(const double* values) const {
+        double sum = 0;
+        for (const Term& t : terms) {
+            double v = t.coef;
+            for (uint32_t i = 0; i < layout.vars; i++) {
+                uint64_t e = layout.exponent(t.key, i);
+                if (e != 0) {
+                    v *= std::pow(values[i], (double)e);
+                }
+            }
+            sum += v;
+        }
+        return sum;
+    }
+
+    // highest total degree first, ties in lexicographic order of the exponents
+    [[nodiscard]] std::vector<Term> sorted() const {
+        std::vector<std::pair<uint64_t, Term>> byDegree;
+        byDegree.reserve(terms.size());
+        for (const Term& t : terms) {
+            byDegree.push_back({layout.degree(t.key), t});
+        }
+        std::sort(byDegree.begin(), byDegree.end(), [](const auto& x, const auto& y) {
+            return x.first != y.first ? x.first > y.first : x.second.key > y.second.key;
+        });
+        std::vector<Term> result;
+        result.reserve(terms.size());
+        for (const auto& [degree, t] : byDegree) {
+            result.push_back(t);
+        }
+        return result;
+    }
+
+    // coefficients of a univariate polynomial by increasing exponent
+    [[nodiscard]] std::vector<double> dense() const {
+        std::vector<double> c(degree(0) + 1);
+        for (const Term& t : terms) {
+            c[layout.exponent(t.key, 0)] = t.coef;
+        }
+        return c;
+    }
+
+private:
+    MonomialLayout layout;
+    std::vector<Term> terms;
+
+    // worth multiplying as a coefficient array, if finite: infinities would turn the array's zeros into NaN there
+    [[nodiscard]] bool isDense() const {
+        return terms.size() >= DENSE_KARATSUBA_MIN && terms.size() * POLY_DENSE_RATIO > degree(0);
+    }
+
+    [[nodiscard]] bool isFinite() const {
+        for (const Term& t : terms) {
+            if (!std::isfinite(t.coef)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/* Expands a parsed tree into a Polynomial over the identifiers it uses, e.g. x*x+2*x*x into 3*x^2.
+ * Supported are + - * and unary minus on anything, / by a constant, ^ with a constant non-negative integer
+ * exponent, and ! on constants; anything else, such as x/y or 2^x, is not a polynomial and fails with a reason.
+ * The tree is walked with an explicit stack, so its depth is only bounded by memory.
+ */
+class Expander {
+public:
+    // false if the tree is not a polynomial or its expansion is too large, see error()
+    bool expand(const TreeNode* root) {
+        slots.clear();
+        std::unordered_map<uint32_t, uint32_t> vars; // symbol slot -> variable
+        collectVariables(root, vars);
+        if (slots.size() > POLY_MAX_VARS) {
+            return fail("too many variables");
+        }
+        MonomialLayout layout((uint32_t)slots.size());
+
+        struct Frame {
+            const TreeNode* node;
+            bool operandsDone;
+        };
+        values.clear();
+        sums.clear();
+        WalkStack<Frame> frames;
+        frames.push({root, false});
+        while (!frames.empty()) {
+            Frame f = frames.pop();
+            const TreeNode* node = f.node;
+            if (!f.operandsDone && pushOperands(node, frames)) {
+                continue;
+            }
+            size_t top = values.size() - 1;
+            switch (node->kind()) {
+                case NodeKind::Double:
+                    values.push_back(Polynomial::constant(layout, static_cast<const Double*>(node)->val));
+                    sums.emplace_back();
+                    break;
+                case NodeKind::Identifier:
+                    values.push_back(Polynomial::variable(layout, vars[static_cast<const Identifier*>(node)->slot]));
+                    sums.emplace_back();
+                    break;
+                case NodeKind::Horner: {
+                    auto* h = static_cast<const Horner*>(node);
+                    if (h->degree > layout.maxExponent()) {
+                        return fail("exponent too large");
+                    }
+                    uint32_t shift = layout.shift(vars[h->slot]);
+                    TermMap sum(h->degree + 1);
+                    for (uint32_t e = 0; e <= h->degree; e++) {
+                        sum.add((uint64_t)e << shift, h->coefs[e]);
+                    }
+                    values.push_back(Polynomial::fromSum(layout, sum));
+                    sums.emplace_back();
+                    break;
+                }
+                case NodeKind::Negate:
+                    settle(top);
+                    values.back() = values.back().scaled(-1);
+                    break;
+                case NodeKind::Factorial:
+                    settle(top);
+                    if (!values.back().isConstant()) {
+                        return fail("! of a non-constant");
+                    }
+                    values.back() = Polynomial::constant(layout, Factorial::fact(values.back().constantValue()));
+                    break;
+                case NodeKind::Add:
+                case NodeKind::Sub: {
+                    // a chain of + and - accumulates into one TermMap rather than copying the partial sum each time
+                    settle(top);
+                    std::unique_ptr<TermMap>& sum = sums[top - 1];
+                    if (sum == nullptr) {
+                        sum = std::make_unique<TermMap>(values[top - 1].size() + values[top].size());
+                        values[top - 1].addTo(*sum);
+                    }
+                    if (!values[top].addTo(*sum, node->kind() == NodeKind::Sub ? -1 : 1)) {
+                        return fail("too many terms");
+                    }
+                    values.pop_back();
+                    sums.pop_back();
+                    break;
+                }
+                default: {
+                    settle(top - 1);
+                    settle(top);
+                    Polynomial r = std::move(values.back());
+                    values.pop_back();
+                    sums.pop_back();
+                    if (!combine(node->kind(), values.back(), r)) {
+                        return false;
+                    }
+                    break;
+                }
+            }
+        }
+        settle(0);
+        result = std::move(values.back());
+        reason = "";
+        return true;
+    }
+
+    [[nodiscard]] const Polynomial& polynomial() const {
+        return result;
+    }
+
+    // why the last expand() failed
+    [[nodiscard]] const char* error() const {
+        return reason;
+    }
+
+    // the value at vars, which are indexed by symbol slot like for TreeNode::eval()
+    [[nodiscard]] double eval(const double* vars) const {
+        std::vector<double> values(slots.size());
+        for (size_t i = 0; i < slots.size(); i++) {
+            values[i] = vars[slots[i]];
+        }
+        return result.eval(values.data());
+    }
+
+    // e.g. 3*x^2*y - x + 0.5; the output parses back into the same polynomial
+    [[nodiscard]] std::string toString(const SymbolTable& symbols) const {
+        std::vector<Term> terms = result.sorted();
+        if (terms.empty()) {
+            return "0";
+        }
+        const MonomialLayout& layout = result.monomials();
+        std::string out;
+        for (size_t n = 0; n < terms.size(); n++) {
+            double c = terms[n].coef;
+            uint64_t key = terms[n].key;
+            if (n > 0) {
+                out.append(c < 0 ? " - " : " + ");
+                c = std::fabs(c);
+            }
+            // -x^2 would read as (-x)^2, so a leading -1 stays before a power
+            bool keepOne = false;
+            for (uint32_t i = 0; n == 0 && c == -1 && i < layout.vars; i++) {
+                if (layout.exponent(key, i) != 0) {
+                    keepOne = layout.exponent(key, i) > 1;
+                    break;
+                }
+            }
+            if (key == 0 || (c != 1 && c != -1) || keepOne) {
+                appendNumber(c, out);
+                if (key != 0) {
+                    out.push_back('*');
+                }
+            } else if (c == -1) {
+                out.push_back('-');
+            }
+            bool first = true;
+            for (uint32_t i = 0; i < layout.vars; i++) {
+                uint64_t e = layout.exponent(key, i);
+                if (e == 0) {
+                    continue;
+                }
+                if (!first) {
+                    out.push_back('*');
+                }
+                first = false;
+                out.append(symbols.name(slots[i]));
+                if (e > 1) {
+                    out.push_back('^');
+                    out.append(std::to_string(e));
+                }
+            }
+        }
+        return out;
+    }
+
+private:
+    Polynomial result{MonomialLayout()};
+    std::vector<uint32_t> slots; // variable -> symbol slot
+    const char* reason = "";
+    std::vector<Polynomial> values; // operands of the walk
+    std::vector<std::unique_ptr<TermMap>> sums; // per operand: a sum being accumulated, which values[i] still lacks
+
+    void settle(size_t i) {
+        if (sums[i] != nullptr) {
+            values[i] = Polynomial::fromSum(values[i].monomials(), *sums[i]);
+            sums[i].reset();
+        }
+    }
+
+    bool fail(const char* why) {
+        reason = why;
+        return false;
+    }
+
+    // numbers variables in order of first appearance
+    void collectVariables(const TreeNode* root, std::unordered_map<uint32_t, uint32_t>& vars) {
+        WalkStack<const TreeNode*> nodes;
+        nodes.push(root);
+        while (!nodes.empty()) {
+            const TreeNode* node = nodes.pop();
+            switch (node->kind()) {
+                case NodeKind::Identifier:
+                case NodeKind::Horner: {
+                    uint32_t slot = node->kind() == NodeKind::Identifier ? static_cast<const Identifier*>(node)->slot
+                                                                         : static_cast<const Horner*>(node)->slot;
+                    if (vars.emplace(slot, (uint32_t)slots.size()).second) {
+                        slots.push_back(slot);
+                    }
+                    break;
+                }
+                case NodeKind::Negate:
+                    nodes.push(static_cast<const Negate*>(node)->arg);
+                    break;
+                case NodeKind::Factorial:
+                    nodes.push(static_cast<const Factorial*>(node)->arg);
+                    break;
+                case NodeKind::Double:
+                    break;
+                default:
+                    nodes.push(static_cast<const InfixOp*>(node)->right);
+                    nodes.push(static_cast<const InfixOp*>(node)->left);
+                    break;
+            }
+        }
+    }
+
+    // pushes node again above its operands; false for leaves
+    template<class Stack>
+    static bool pushOperands(const TreeNode* node, Stack& frames) {
+        switch (node->kind()) {
+            case NodeKind::Double:
+            case NodeKind::Identifier:
+            case NodeKind::Horner:
+                return false;
+            case NodeKind::Negate:
+                frames.push({node, true});
+                frames.push({static_cast<const Negate*>(node)->arg, false});
+                return true;
+            case NodeKind::Factorial:
+                frames.push({node, true});
+                frames.push({static_cast<const Factorial*>(node)->arg, false});
+                return true;
+            default:
+                frames.push({node, true});
+                frames.push({static_cast<const InfixOp*>(node)->right, false});
+                frames.push({static_cast<const InfixOp*>(node)->left, false});
+                return true;
+        }
+    }
+
+    // l = l op r for * / and ^
+    bool combine(NodeKind kind, Polynomial& l, const Polynomial& r) {
+        PolyStatus status = PolyStatus::Ok;
+        switch (kind) {
+            case NodeKind::Mul:
+                status = Polynomial::multiply(l, r, l);
+                break;
+            case NodeKind::Div:
+                if (!r.isConstant()) {
+                    return fail("division by a non-constant");
+                }
+                if (l.isConstant()) { // keeps x/0 and 0/0 as inf and nan like the evaluators
+                    l = Polynomial::constant(l.monomials(), l.constantValue() / r.constantValue());
+                } else {
+                    l = l.scaled(1 / r.constantValue());
+                }
+                break;
+            default: { // Caret
+                if (!r.isConstant()) {
+                    return fail("non-constant exponent");
+                }
+                double e = r.constantValue();
+                if (l.isConstant()) {
+                    l = Polynomial::constant(l.monomials(), pow(l.constantValue(), e));
+                    break;
+                }
+                if (e < 0 || e != std::floor(e) || e > POLY_MAX_POWER) {
+                    return fail("exponent is not a non-negative integer");
+                }
+                status = Polynomial::power(l, (uint64_t)e, l);
+                break;
+            }
+        }
+        switch (status) {
+            case PolyStatus::ExponentOverflow:
+                return fail("exponent too large");
+            case PolyStatus::TooManyTerms:
+                return fail("too many terms");
+            case PolyStatus::CoefficientOverflow:
+                return fail("coefficients overflow");
+            default:
+                return true;
+        }
+    }
+
+    static void appendNumber(double v, std::string& out) {
+        char num[32];
+        out.append(num, std::to_chars(num, num + sizeof num, v).ptr); // shortest text that reads back as v
+    }
+};
+
+#endif //CALCULATOR_POLY_H
@@ -0,0 +1,400 @@
+#ifndef CALCULATOR_SERVER_H
+#define CALCULATOR_SERVER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "batch.h"
+
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#define SERVER_EPOLL
+#endif
+
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_MAX_BUFFERED (4 * 1024 * 1024) // per connection: input waiting for a worker, output waiting for the client
+#define SERVER_DEFAULT_CACHE 1024 // compiled expressions kept per worker unless --cache says otherwise
+
+#ifdef SERVER_EPOLL
+
+/* Long-running server speaking the batch line protocol: clients send newline-delimited expressions, possibly
+ * pipelined, and get one result line per expression back, in order. One thread runs a level-triggered epoll
+ * loop that accepts connections and moves bytes; whole lines are handed to a pool of workers, each with its own
+ * LineEvaluator and expression cache, which therefore stays warm across requests and connections.
+ * A connection has at most one job in flight, which keeps its replies in order; everything that arrives
+ * meanwhile is sent as one job when that job returns. Finished jobs wake the loop through an eventfd.
+ */
+class Server {
+public:
+    explicit Server(unsigned threads, size_t cacheCapacity = SERVER_DEFAULT_CACHE)
+            : threads(threads == 0 ? 1 : threads), cacheCapacity(cacheCapacity) {
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        watch(wakeFd, WAKE_ID, EPOLLIN);
+    }
+    Server(const Server&) = delete;
+    Server& operator=(const Server&) = delete;
+    ~Server() {
+        for (auto& [id, c] : connections) {
+            close(c.fd);
+        }
+        for (int fd : listeners) {
+            close(fd);
+        }
+        if (!unixPath.empty()) {
+            unlink(unixPath.c_str());
+        }
+        close(wakeFd);
+        close(epollFd);
+    }
+
+    // listens on a Unix domain socket at path, replacing a stale socket left there; false with errno set on failure
+    bool listenUnix(const char* path) {
+        sockaddr_un addr{};
+        if (std::strlen(path) >= sizeof addr.sun_path) {
+            errno = ENAMETOOLONG;
+            return false;
+        }
+        addr.sun_family = AF_UNIX;
+        std::strcpy(addr.sun_path, path);
+        struct stat st{};
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path);
+        }
+        int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        if (bind(fd, (sockaddr*) &addr, sizeof addr) != 0 || listen(fd, SOMAXCONN) != 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return false;
+        }
+        unixPath = path;
+        addListener(fd);
+        return true;
+    }
+
+    // listens on 127.0.0.1:port only; false with errno set on failure
+    bool listenTcp(uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            return false;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof one);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (sockaddr*) &addr, sizeof addr) != 0 || listen(fd, SOMAXCONN) != 0) {
+            int saved = errno;
+            close(fd);
+            errno = saved;
+            return false;
+        }
+        addListener(fd);
+        return true;
+    }
+
+    // serves until stop(); returns 0, or -1 if the event loop failed
+    int run() {
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < threads; i++) {
+            workers.emplace_back([this] { work(); });
+        }
+        int status = loop();
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            workersDone = true;
+            jobReady.notify_all();
+        }
+        for (std::thread& t : workers) {
+            t.join();
+        }
+        return status;
+    }
+
+    // safe to call from any thread and from a signal handler
+    void stop() {
+        stopping.store(true);
+        uint64_t one = 1;
+        (void) !write(wakeFd, &one, sizeof one);
+    }
+
+private:
+    static constexpr uint64_t WAKE_ID = 0;
+    static constexpr uint64_t LISTENER_BIT = 1ull << 63; // epoll ids of listeners; connections count up from 1
+
+    struct Connection {
+        int fd;
+        uint32_t events; // currently registered with epoll
+        std::string in = {}; // received bytes not yet sent to a worker
+        std::string out = {}; // results not yet written
+        size_t outSent = 0; // prefix of out already written
+        bool busy = false; // a job of this connection is with the workers
+        bool peerClosed = false; // no more input will come
+        bool skipping = false; // input is discarded up to the next newline, the rest of an overlong line
+    };
+
+    struct Job {
+        uint64_t connection;
+        std::string text; // whole lines
+        std::string out;
+    };
+
+    unsigned threads;
+    size_t cacheCapacity; // per worker
+    int epollFd;
+    int wakeFd;
+    std::vector<int> listeners;
+    std::string unixPath;
+    std::unordered_map<uint64_t, Connection> connections;
+    uint64_t nextId = 1;
+    std::atomic<bool> stopping{false};
+
+    std::mutex jobMutex;
+    std::condition_variable jobReady;
+    std::deque<std::unique_ptr<Job>> jobs;
+    bool workersDone = false;
+
+    std::mutex doneMutex;
+    std::vector<std::unique_ptr<Job>> done;
+
+    void watch(int fd, uint64_t id, uint32_t events) {
+        epoll_event ev{};
+        ev.events = events;
+        ev.data.u64 = id;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+    }
+
+    void addListener(int fd) {
+        watch(fd, LISTENER_BIT | listeners.size(), EPOLLIN);
+        listeners.push_back(fd);
+    }
+
+    int loop() {
+        epoll_event events[64];
+        while (!stopping.load()) {
+            int n = epoll_wait(epollFd, events, 64, -1);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                return -1;
+            }
+            for (int i = 0; i < n; i++) {
+                uint64_t id = events[i].data.u64;
+                if (id == WAKE_ID) {
+                    uint64_t count;
+                    (void) !read(wakeFd, &count, sizeof count);
+                    collect();
+                } else if (id & LISTENER_BIT) {
+                    accept(listeners[id & ~LISTENER_BIT]);
+                } else {
+                    handle(id, events[i].events);
+                }
+            }
+        }
+        return 0;
+    }
+
+    void accept(int listener) {
+        while (true) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0) {
+                return; // EAGAIN once the backlog is empty; other errors concern only that connection
+            }
+            uint64_t id = nextId++;
+            connections.emplace(id, Connection{fd, EPOLLIN | EPOLLRDHUP});
+            watch(fd, id, EPOLLIN | EPOLLRDHUP);
+        }
+    }
+
+    void handle(uint64_t id, uint32_t events) {
+        auto it = connections.find(id);
+        if (it == connections.end()) {
+            return; // closed earlier in this batch of events
+        }
+        Connection& c = it->second;
+        if (events & EPOLLERR) {
+            drop(id);
+            return;
+        }
+        if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+            char buf[SERVER_READ_SIZE];
+            ssize_t n = read(c.fd, buf, sizeof buf);
+            if (n > 0) {
+                c.in.append(buf, n);
+                if (c.skipping) {
+                    skip(c);
+                }
+            } else if (n == 0) {
+                c.peerClosed = true;
+            } else if (errno != EAGAIN && errno != EINTR) {
+                drop(id);
+                return;
+            }
+        }
+        if ((events & EPOLLOUT) && !flush(id, c)) {
+            return;
+        }
+        dispatch(id, c);
+        settle(id, c);
+    }
+
+    // sends the complete lines of c to the workers unless it already has a job there or the client is not reading;
+    // either way input then piles up until reading pauses, which pushes back on the client through TCP
+    void dispatch(uint64_t id, Connection& c) {
+        if (c.busy || c.in.empty() || c.out.size() - c.outSent >= SERVER_MAX_BUFFERED) {
+            return;
+        }
+        size_t cut = c.in.rfind('\n');
+        if (cut == std::string::npos && c.in.size() >= SERVER_MAX_BUFFERED) {
+            // reading has stopped, so the newline would never arrive: answer the line with an error instead
+            c.out.append("Invalid input: line longer than " + std::to_string(SERVER_MAX_BUFFERED) + " bytes.\n");
+            c.in.clear();
+            c.skipping = true;
+            return;
+        }
+        size_t length = cut == std::string::npos ? (c.peerClosed ? c.in.size() : 0) : cut + 1;
+        if (length == 0) {
+            return;
+        }
+        auto job = std::make_unique<Job>();
+        job->connection = id;
+        job->text.assign(c.in, 0, length);
+        c.in.erase(0, length);
+        c.busy = true;
+        std::lock_guard<std::mutex> lock(jobMutex);
+        jobs.push_back(std::move(job));
+        jobReady.notify_one();
+    }
+
+    // drops the input of c up to and including the newline that ends an overlong line
+    static void skip(Connection& c) {
+        size_t cut = c.in.find('\n');
+        if (cut == std::string::npos) {
+            c.in.clear();
+            return;
+        }
+        c.in.erase(0, cut + 1);
+        c.skipping = false;
+    }
+
+    // takes finished jobs from the workers and queues their results
+    void collect() {
+        std::vector<std::unique_ptr<Job>> finished;
+        {
+            std::lock_guard<std::mutex> lock(doneMutex);
+            finished.swap(done);
+        }
+        for (std::unique_ptr<Job>& job : finished) {
+            auto it = connections.find(job->connection);
+            if (it == connections.end()) {
+                continue; // the client went away meanwhile
+            }
+            Connection& c = it->second;
+            c.busy = false;
+            c.out.append(job->out);
+            if (!flush(job->connection, c)) {
+                continue;
+            }
+            dispatch(job->connection, c);
+            settle(job->connection, c);
+        }
+    }
+
+    // writes as much of c.out as the socket takes; false if the connection was dropped
+    bool flush(uint64_t id, Connection& c) {
+        while (c.outSent < c.out.size()) {
+            ssize_t n = send(c.fd, c.out.data() + c.outSent, c.out.size() - c.outSent, MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EAGAIN || errno == EINTR) {
+                    break;
+                }
+                drop(id);
+                return false;
+            }
+            c.outSent += n;
+        }
+        if (c.outSent == c.out.size()) {
+            c.out.clear();
+            c.outSent = 0;
+        }
+        return true;
+    }
+
+    // closes c once everything is answered, otherwise registers for the events it is waiting on
+    void settle(uint64_t id, Connection& c) {
+        if (c.peerClosed && !c.busy && c.in.empty() && c.out.empty()) {
+            drop(id);
+            return;
+        }
+        uint32_t events = 0;
+        if (!c.peerClosed && c.in.size() < SERVER_MAX_BUFFERED) {
+            events |= EPOLLIN | EPOLLRDHUP;
+        }
+        if (!c.out.empty()) {
+            events |= EPOLLOUT;
+        }
+        if (events != c.events) {
+            epoll_event ev{};
+            ev.events = events;
+            ev.data.u64 = id;
+            epoll_ctl(epollFd, EPOLL_CTL_MOD, c.fd, &ev);
+            c.events = events;
+        }
+    }
+
+    void drop(uint64_t id) {
+        auto it = connections.find(id);
+        close(it->second.fd); // also removes it from the epoll set
+        connections.erase(it);
+    }
+
+    void work() {
+        LineEvaluator evaluator(cacheCapacity);
+        while (true) {
+            std::unique_ptr<Job> job;
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobReady.wait(lock, [this] { return !jobs.empty() || workersDone; });
+                if (jobs.empty()) {
+                    return;
+                }
+                job = std::move(jobs.front());
+                jobs.pop_front();
+            }
+            evaluator.evalLines(job->text.data(), job->text.data() + job->text.size(), job->out);
+            {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                done.push_back(std::move(job));
+            }
+            uint64_t one = 1;
+            (void) !write(wakeFd, &one, sizeof one);
+        }
+    }
+};
+
+#endif
+
+#endif //CALCULATOR_SERVER_H
@@ -0,0 +1,218 @@
+#ifndef CALCULATOR_SIMPLIFY_H
+#define CALCULATOR_SIMPLIFY_H
+
+#include "tree.h"
+#include "arena.h"
+#include "horner.h"
+
+#define SIMPLIFY_MAX_POWER 4 // x^n with a constant integer 2 <= n <= this becomes a chain of multiplications
+
+/* Bottom-up rewriting of a parsed tree so that repeated evaluation does less work:
+ *      constant subtrees fold into one Double          (2^10)*x + 3!*y  ->  (1024*x)+(6*y)
+ *      identities disappear                            x*1, 1*x, x+(-0), (-0)+x, x-0, x/1, x^1, --x  ->  x
+ *      x^0 -> 1, (-0)-x -> -x, and small integer powers of an identifier are strength-reduced
+ *                                                      x^3 -> (x*x)*x,  x^-1 -> 1/x
+ *      finally, polynomials in one identifier become Horner nodes, see HornerRewriter
+ *                                                      2*x^5 + x^2 - 1  ->  (-1+(x*(x*(1+(x*(x*(x*2)))))))
+ * New nodes come from the arena passed in; untouched subtrees are reused, not copied.
+ */
+class Simplifier {
+public:
+    explicit Simplifier(Arena& arena) : arena(arena) {}
+
+    // post-order with explicit stacks: every node is rewritten after its operands
+    TreeNode* simplify(TreeNode* root) {
+        struct Frame {
+            TreeNode* node;
+            bool operandsDone;
+        };
+        WalkStack<Frame> frames;
+        WalkStack<TreeNode*> results;
+        frames.push({root, false});
+        while (!frames.empty()) {
+            Frame f = frames.pop();
+            TreeNode* node = f.node;
+            switch (node->kind()) {
+                case NodeKind::Add:
+                case NodeKind::Sub:
+                case NodeKind::Mul:
+                case NodeKind::Div:
+                case NodeKind::Caret: {
+                    auto* op = static_cast<InfixOp*>(node);
+                    if (!f.operandsDone) {
+                        frames.push({node, true});
+                        frames.push({op->right, false});
+                        frames.push({op->left, false});
+                        break;
+                    }
+                    TreeNode* r = results.pop();
+                    TreeNode* l = results.pop();
+                    results.push(simplifyInfix(op, l, r));
+                    break;
+                }
+                case NodeKind::Negate:
+                case NodeKind::Factorial:
+                    if (!f.operandsDone) {
+                        frames.push({node, true});
+                        frames.push({node->kind() == NodeKind::Negate ? static_cast<Negate*>(node)->arg
+                                                                       : static_cast<Factorial*>(node)->arg, false});
+                        break;
+                    }
+                    if (node->kind() == NodeKind::Negate) {
+                        results.top() = simplifyNegate(static_cast<Negate*>(node), results.top());
+                    } else {
+                        results.top() = simplifyFactorial(static_cast<Factorial*>(node), results.top());
+                    }
+                    break;
+                case NodeKind::Double:
+                case NodeKind::Identifier:
+                case NodeKind::Horner:
+                    results.push(node);
+                    break;
+            }
+        }
+        return HornerRewriter(arena).rewrite(results.top());
+    }
+
+private:
+    Arena& arena;
+
+    static double value(const TreeNode* constant) {
+        return static_cast<const Double*>(constant)->val;
+    }
+
+    static bool isConstant(const TreeNode* node, double v) {
+        return node->kind() == NodeKind::Double && value(node) == v;
+    }
+
+    // a zero constant with the given sign
+    static bool isZero(const TreeNode* node, bool negative) {
+        return isConstant(node, 0) && std::signbit(value(node)) == negative;
+    }
+
+    // neg is the original node, a its simplified operand; neg is null for a new negation
+    TreeNode* simplifyNegate(Negate* neg, TreeNode* a) {
+        if (a->kind() == NodeKind::Double) {
+            return arena.make<Double>(-value(a));
+        }
+        if (a->kind() == NodeKind::Negate) {
+            return static_cast<Negate*>(a)->arg;
+        }
+        return neg != nullptr && a == neg->arg ? neg : arena.make<Negate>(a);
+    }
+
+    TreeNode* simplifyFactorial(Factorial* f, TreeNode* a) {
+        if (a->kind() == NodeKind::Double) {
+            return arena.make<Double>(Factorial::fact(value(a)));
+        }
+        return a == f->arg ? f : arena.make<Factorial>(a);
+    }
+
+    // l and r are the simplified operands of op
+    TreeNode* simplifyInfix(InfixOp* op, TreeNode* l, TreeNode* r) {
+        NodeKind kind = op->kind();
+        if (l->kind() == NodeKind::Double && r->kind() == NodeKind::Double) {
+            return arena.make<Double>(apply(kind, value(l), value(r)));
+        }
+        switch (kind) {
+            case NodeKind::Add: // only -0 is an identity: -0 + +0 is +0
+                if (isZero(l, true)) {
+                    return r;
+                }
+                if (isZero(r, true)) {
+                    return l;
+                }
+                break;
+            case NodeKind::Sub: // only with +0 on the right, and -0 on the left: +0 - +0 is +0, not -(+0)
+                if (isZero(r, false)) {
+                    return l;
+                }
+                if (isZero(l, true)) {
+                    return simplifyNegate(nullptr, r);
+                }
+                break;
+            case NodeKind::Mul:
+                if (isConstant(l, 1)) {
+                    return r;
+                }
+                if (isConstant(r, 1)) {
+                    return l;
+                }
+                break;
+            case NodeKind::Div:
+                if (isConstant(r, 1)) {
+                    return l;
+                }
+                break;
+            case NodeKind::Caret:
+                if (r->kind() == NodeKind::Double) {
+                    return simplifyPower(l, r, op);
+                }
+                break;
+            default:
+                break;
+        }
+        if (l == op->left && r == op->right) {
+            return op;
+        }
+        return make(kind, l, r);
+    }
+
+    TreeNode* simplifyPower(TreeNode* base, TreeNode* exponent, InfixOp* op) {
+        double e = value(exponent);
+        if (e == 0) {
+            return arena.make<Double>(1); // pow(x, 0) is 1 for every x, NaN included
+        }
+        if (e == 1) {
+            return base;
+        }
+        if (base->kind() == NodeKind::Identifier) {
+            if (e == -1) {
+                return arena.make<Div>(arena.make<Double>(1), base);
+            }
+            if (e >= 2 && e <= SIMPLIFY_MAX_POWER && e == (int)e) {
+                TreeNode* product = base;
+                for (int i = 1; i < (int)e; i++) {
+                    product = arena.make<Mul>(product, base);
+                }
+                return product;
+            }
+        }
+        if (base == op->left && exponent == op->right) {
+            return op;
+        }
+        return arena.make<Caret>(base, exponent);
+    }
+
+    static double apply(NodeKind kind, double a, double b) {
+        switch (kind) {
+            case NodeKind::Add:
+                return a + b;
+            case NodeKind::Sub:
+                return a - b;
+            case NodeKind::Mul:
+                return a * b;
+            case NodeKind::Div:
+                return a / b;
+            default:
+                return pow(a, b);
+        }
+    }
+
+    TreeNode* make(NodeKind kind, TreeNode* l, TreeNode* r) {
+        switch (kind) {
+            case NodeKind::Add:
+                return arena.make<Add>(l, r);
+            case NodeKind::Sub:
+                return arena.make<Sub>(l, r);
+            case NodeKind::Mul:
+                return arena.make<Mul>(l, r);
+            case NodeKind::Div:
+                return arena.make<Div>(l, r);
+            default:
+                return arena.make<Caret>(l, r);
+        }
+    }
+};
+
+#endif //CALCULATOR_SIMPLIFY_H
@@ -0,0 +1,51 @@
+#ifndef CALCULATOR_SYMBOLS_H
+#define CALCULATOR_SYMBOLS_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/* Maps identifier names to dense slots 0, 1, 2, ... in order of first appearance.
+ * Names are only looked up while parsing; evaluation reads vars[slot] from a flat array of size().
+ */
+class SymbolTable {
+public:
+    uint32_t intern(std::string_view name) {
+        auto it = slots.find(name);
+        if (it != slots.end()) {
+            return it->second;
+        }
+        auto slot = (uint32_t)names.size();
+        names.emplace_back(name);
+        slots.emplace(names.back(), slot); // keys view into names, which never moves its elements
+        return slot;
+    }
+
+    // returns -1 if the name never appeared in a parsed expression
+    [[nodiscard]] int64_t lookup(std::string_view name) const {
+        auto it = slots.find(name);
+        return it == slots.end() ? -1 : (int64_t)it->second;
+    }
+
+    [[nodiscard]] const std::string& name(uint32_t slot) const {
+        return names[slot];
+    }
+
+    [[nodiscard]] size_t size() const {
+        return names.size();
+    }
+
+    // forgets every name; slots handed out before are reused
+    void clear() {
+        slots.clear();
+        names.clear();
+    }
+
+private:
+    std::deque<std::string> names;
+    std::unordered_map<std::string_view, uint32_t> slots;
+};
+
+#endif //CALCULATOR_SYMBOLS_H
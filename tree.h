@@ -0,0 +1,481 @@
+#ifndef CALCULATOR_TREE_H
+#define CALCULATOR_TREE_H
+
+#include <algorithm>
+#include <iostream>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+enum class NodeKind {
+    Add, Sub, Mul, Div, Caret, Negate, Factorial, Double, Identifier, Horner
+};
+
+#define TREE_WALK_LOCAL 64 // stack entries a tree walk keeps in a local array before moving to the heap
+#define TREE_EVAL_RECURSION 1000 // levels eval() recurses natively before continuing with an explicit stack
+
+// explicit stack for walking a tree without recursion; only trees deeper than N touch the heap
+template<class T, size_t N = TREE_WALK_LOCAL>
+class WalkStack {
+public:
+    WalkStack() = default;
+    WalkStack(const WalkStack&) = delete;
+    WalkStack& operator=(const WalkStack&) = delete;
+
+    void push(const T& v) {
+        if (n == capacity) {
+            std::vector<T> bigger(capacity * 2);
+            std::copy(items, items + n, bigger.begin());
+            heap.swap(bigger);
+            items = heap.data();
+            capacity *= 2;
+        }
+        items[n++] = v;
+    }
+
+    T pop() {
+        return items[--n];
+    }
+
+    T& top() {
+        return items[n - 1];
+    }
+
+    [[nodiscard]] bool empty() const {
+        return n == 0;
+    }
+
+private:
+    T local[N];
+    std::vector<T> heap;
+    T* items = local;
+    size_t n = 0;
+    size_t capacity = N;
+};
+
+// nodes are allocated from an Arena (arena.h) and released together with it, never deleted one by one
+class TreeNode {
+public:
+    [[nodiscard]] virtual NodeKind kind() const = 0;
+    // vars is indexed by Identifier::slot; neither eval() nor print() recurses deeper than a fixed bound, so
+    // nesting depth is limited by memory, not by the native stack
+    [[nodiscard]] double eval(const double* vars) const {
+        return evalWithin(vars, TREE_EVAL_RECURSION);
+    }
+    // evaluates with at most budget more levels of native recursion, then continues with an explicit stack
+    [[nodiscard]] virtual double evalWithin(const double* vars, int budget) const = 0;
+    void print() const;
+    virtual ~TreeNode() = default;
+
+protected:
+    static double evalIterative(const TreeNode* root, const double* vars);
+};
+
+class InfixOp : public TreeNode {
+public:
+    TreeNode* left;
+    TreeNode* right;
+    InfixOp(TreeNode* l, TreeNode* r) : TreeNode(), left(l), right(r) {};
+};
+
+class Add : public InfixOp {
+public:
+    Add(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Add;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return left->evalWithin(vars, budget - 1) + right->evalWithin(vars, budget - 1);
+    }
+};
+
+class Sub : public InfixOp {
+public:
+    Sub(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Sub;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return left->evalWithin(vars, budget - 1) - right->evalWithin(vars, budget - 1);
+    }
+};
+
+class Mul : public InfixOp {
+public:
+    Mul(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Mul;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return left->evalWithin(vars, budget - 1) * right->evalWithin(vars, budget - 1);
+    }
+};
+
+class Div : public InfixOp {
+public:
+    Div(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Div;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return left->evalWithin(vars, budget - 1) / right->evalWithin(vars, budget - 1);
+    }
+};
+
+class Caret : public InfixOp {
+public:
+    Caret(TreeNode* l, TreeNode* r) : InfixOp(l, r) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Caret;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return pow(left->evalWithin(vars, budget - 1), right->evalWithin(vars, budget - 1));
+    }
+};
+
+class Negate : public TreeNode {
+public:
+    TreeNode* arg;
+    explicit Negate(TreeNode* a) : TreeNode(), arg(a) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Negate;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return -arg->evalWithin(vars, budget - 1);
+    }
+};
+
+#define FACTORIAL_TABLE_SIZE 171 // 170! is the largest factorial a double can hold
+
+/* 0! .. 170!, computed at compile time and correctly rounded: the running product is kept as an unevaluated
+ * sum hi + lo (double-double, about 106 bits) scaled by 2^exp, so the repeated multiplications do not accumulate
+ * rounding error before the single final rounding to double.
+ */
+struct FactorialTable {
+    double values[FACTORIAL_TABLE_SIZE];
+    constexpr FactorialTable() : values() {
+        double hi = 1, lo = 0;
+        int exp = 0;
+        values[0] = 1;
+        for (int i = 1; i < FACTORIAL_TABLE_SIZE; i++) {
+            // Dekker's exact product hi * i == p + e, split at 27 bits
+            double c = 134217729.0 * hi, hiHigh = c - (c - hi), hiLow = hi - hiHigh;
+            double p = hi * i;
+            double e = hiHigh * i - p + hiLow * i + lo * i; // i < 2^27, so it needs no split
+            hi = p + e;
+            lo = e - (hi - p);
+            while (hi >= 2) { // keep hi in [1, 2) so the split never overflows; halving is exact
+                hi /= 2;
+                lo /= 2;
+                exp++;
+            }
+            double v = hi + lo;
+            for (int k = 0; k < exp; k++) {
+                v *= 2;
+            }
+            values[i] = v;
+        }
+    }
+};
+
+inline constexpr FactorialTable factorialTable;
+
+class Factorial : public TreeNode {
+public:
+    TreeNode* arg;
+    explicit Factorial(TreeNode* a) : TreeNode(), arg(a) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Factorial;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int budget) const override {
+        if (budget == 0) {
+            return evalIterative(this, vars);
+        }
+        return fact(arg->evalWithin(vars, budget - 1));
+    }
+    // table lookup for integers, Gamma(in + 1) otherwise; NaN for negative integers, inf past 170!
+    [[nodiscard]] static double fact(double in) {
+        if (in >= 0 && in < FACTORIAL_TABLE_SIZE && in == (int)in) {
+            return factorialTable.values[(int)in];
+        }
+        if (in < 0 && in == std::floor(in)) {
+            return NAN; // poles of Gamma
+        }
+        return std::tgamma(in + 1);
+    }
+};
+
+class Double : public TreeNode {
+public:
+    double val;
+    explicit Double(double v) : TreeNode(), val(v) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Double;
+    }
+    [[nodiscard]] double evalWithin(const double*, int) const override {
+        return val;
+    }
+};
+
+class Identifier : public TreeNode {
+public:
+    const char* str;
+    uint32_t slot;
+    explicit Identifier(const char* s, uint32_t i) : TreeNode(), str(s), slot(i) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Identifier;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int) const override {
+        return vars[slot];
+    }
+};
+
+#define HORNER_ESTRIN_MIN 16 // from this degree on, Estrin's scheme in blocks of 8 coefficients
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TREE_FMA_DISPATCH
+#endif
+
+/* c[0] + c[1]*x + ... + c[degree]*x^degree with one multiply-add per coefficient. Below HORNER_ESTRIN_MIN this
+ * is Horner's rule, a single dependency chain. Higher degrees are cut into blocks of 8 coefficients that Estrin's
+ * scheme evaluates as a tree of depth 3 in x, x^2 and x^4; the blocks do not depend on each other, so their
+ * multiply-adds overlap, and only the block results are chained by Horner's rule in x^8.
+ */
+#define HORNER_KERNEL(name, attributes, muladd) \
+    attributes inline double name(const double* c, uint32_t degree, double x) { \
+        double r = c[degree]; \
+        if (degree < HORNER_ESTRIN_MIN) { \
+            for (uint32_t i = degree; i-- > 0;) { \
+                r = muladd(r, x, c[i]); \
+            } \
+            return r; \
+        } \
+        uint32_t blocks = (degree + 1) / 8; \
+        for (uint32_t i = degree; i-- > blocks * 8;) { /* the top (degree + 1) % 8 coefficients */ \
+            r = muladd(r, x, c[i]); \
+        } \
+        double x2 = x * x, x4 = x2 * x2, x8 = x4 * x4; \
+        bool first = (degree + 1) % 8 == 0; /* then r is still c[degree], which the top block includes */ \
+        for (uint32_t b = blocks; b-- > 0;) { \
+            const double* p = c + 8 * b; \
+            double q0 = muladd(muladd(p[3], x, p[2]), x2, muladd(p[1], x, p[0])); \
+            double q1 = muladd(muladd(p[7], x, p[6]), x2, muladd(p[5], x, p[4])); \
+            double block = muladd(q1, x4, q0); \
+            r = first ? block : muladd(r, x8, block); \
+            first = false; \
+        } \
+        return r; \
+    }
+
+#define HORNER_FUSED(a, b, c) std::fma(a, b, c)
+#define HORNER_UNFUSED(a, b, c) ((a) * (b) + (c))
+
+#ifdef TREE_FMA_DISPATCH
+HORNER_KERNEL(hornerFma, __attribute__((target("fma"))), HORNER_FUSED)
+HORNER_KERNEL(hornerPlain, , HORNER_UNFUSED) // std::fma would be a slow software emulation on these CPUs
+#else
+HORNER_KERNEL(hornerFma, , HORNER_FUSED)
+#endif
+
+using HornerFn = double (*)(const double* c, uint32_t degree, double x);
+
+// FMA3 instructions when the running CPU has them, picked once
+inline HornerFn hornerKernel() {
+#ifdef TREE_FMA_DISPATCH
+    static const HornerFn kernel = __builtin_cpu_supports("fma") ? hornerFma : hornerPlain;
+    return kernel;
+#else
+    return hornerFma;
+#endif
+}
+
+/* A polynomial in one identifier, c[0] + c[1]*x + ... + c[degree]*x^degree, that HornerRewriter (horner.h) put
+ * in place of a subtree of + - * / and ^ nodes: it costs degree multiply-adds instead of a pow() per term.
+ */
+class Horner : public TreeNode {
+public:
+    const double* coefs; // degree + 1 of them, by increasing exponent, in the same arena as the node
+    uint32_t degree;
+    const char* str;
+    uint32_t slot;
+    Horner(const double* c, uint32_t degree, const char* s, uint32_t i)
+            : TreeNode(), coefs(c), degree(degree), str(s), slot(i) {};
+    [[nodiscard]] NodeKind kind() const override {
+        return NodeKind::Horner;
+    }
+    [[nodiscard]] double evalWithin(const double* vars, int) const override {
+        return at(vars[slot]);
+    }
+    [[nodiscard]] double at(double x) const {
+        return hornerKernel()(coefs, degree, x);
+    }
+};
+
+// the explicit-stack walk behind evalWithin() once the recursion budget is spent; leaf operands are read in
+// place rather than getting frames of their own
+inline double TreeNode::evalIterative(const TreeNode* root, const double* vars) {
+    struct Frame {
+        const TreeNode* node;
+        bool operandsDone;
+    };
+    auto isLeaf = [](const TreeNode* node) {
+        return node->kind() == NodeKind::Double || node->kind() == NodeKind::Identifier
+               || node->kind() == NodeKind::Horner;
+    };
+    WalkStack<Frame> frames;
+    WalkStack<double> values;
+    frames.push({root, false});
+    while (!frames.empty()) {
+        Frame f = frames.pop();
+        switch (f.node->kind()) {
+            case NodeKind::Add:
+            case NodeKind::Sub:
+            case NodeKind::Mul:
+            case NodeKind::Div:
+            case NodeKind::Caret: {
+                auto* op = static_cast<const InfixOp*>(f.node);
+                if (!f.operandsDone) {
+                    frames.push({op, true});
+                    if (!isLeaf(op->right)) {
+                        frames.push({op->right, false});
+                    }
+                    if (isLeaf(op->left)) {
+                        values.push(op->left->evalWithin(vars, 0));
+                    } else {
+                        frames.push({op->left, false}); // on top, so the left operand is evaluated first
+                    }
+                    break;
+                }
+                double r = isLeaf(op->right) ? op->right->evalWithin(vars, 0) : values.pop();
+                double& l = values.top();
+                switch (op->kind()) {
+                    case NodeKind::Add:
+                        l = l + r;
+                        break;
+                    case NodeKind::Sub:
+                        l = l - r;
+                        break;
+                    case NodeKind::Mul:
+                        l = l * r;
+                        break;
+                    case NodeKind::Div:
+                        l = l / r;
+                        break;
+                    default:
+                        l = pow(l, r);
+                        break;
+                }
+                break;
+            }
+            case NodeKind::Negate:
+                if (!f.operandsDone) {
+                    frames.push({f.node, true});
+                    frames.push({static_cast<const Negate*>(f.node)->arg, false});
+                } else {
+                    values.top() = -values.top();
+                }
+                break;
+            case NodeKind::Factorial:
+                if (!f.operandsDone) {
+                    frames.push({f.node, true});
+                    frames.push({static_cast<const Factorial*>(f.node)->arg, false});
+                } else {
+                    values.top() = Factorial::fact(values.top());
+                }
+                break;
+            case NodeKind::Double:
+                values.push(static_cast<const Double*>(f.node)->val);
+                break;
+            case NodeKind::Identifier:
+                values.push(vars[static_cast<const Identifier*>(f.node)->slot]);
+                break;
+            case NodeKind::Horner:
+                values.push(f.node->evalWithin(vars, 0));
+                break;
+        }
+    }
+    return values.top();
+}
+
+// fully parenthesized: (a+b), (-a), (a!); a Horner node as the nesting it evaluates, (1+(x*(2+(x*3))))
+inline void TreeNode::print() const {
+    struct Item {
+        const TreeNode* node; // printed if not null, otherwise text is
+        const char* text;
+    };
+    WalkStack<Item> items;
+    items.push({this, nullptr});
+    while (!items.empty()) {
+        Item item = items.pop();
+        if (item.node == nullptr) {
+            std::cout << item.text;
+            continue;
+        }
+        switch (item.node->kind()) {
+            case NodeKind::Add:
+            case NodeKind::Sub:
+            case NodeKind::Mul:
+            case NodeKind::Div:
+            case NodeKind::Caret: {
+                static const char* const symbols[] = {"+", "-", "*", "/", "^"};
+                auto* op = static_cast<const InfixOp*>(item.node);
+                items.push({nullptr, ")"}); // pushed in reverse order
+                items.push({op->right, nullptr});
+                items.push({nullptr, symbols[(int)op->kind()]});
+                items.push({op->left, nullptr});
+                items.push({nullptr, "("});
+                break;
+            }
+            case NodeKind::Negate:
+                items.push({nullptr, ")"});
+                items.push({static_cast<const Negate*>(item.node)->arg, nullptr});
+                items.push({nullptr, "(-"});
+                break;
+            case NodeKind::Factorial:
+                items.push({nullptr, "!)"});
+                items.push({static_cast<const Factorial*>(item.node)->arg, nullptr});
+                items.push({nullptr, "("});
+                break;
+            case NodeKind::Double:
+                std::cout << static_cast<const Double*>(item.node)->val;
+                break;
+            case NodeKind::Identifier:
+                std::cout << static_cast<const Identifier*>(item.node)->str;
+                break;
+            case NodeKind::Horner: { // zero coefficients are left out
+                auto* h = static_cast<const Horner*>(item.node);
+                for (uint32_t i = 0; i < h->degree; i++) {
+                    if (h->coefs[i] != 0) {
+                        std::cout << "(" << h->coefs[i] << "+";
+                    }
+                    std::cout << "(" << h->str << "*";
+                }
+                std::cout << h->coefs[h->degree];
+                for (uint32_t i = h->degree; i-- > 0;) {
+                    std::cout << (h->coefs[i] != 0 ? "))" : ")");
+                }
+                break;
+            }
+        }
+    }
+}
+
+#endif //CALCULATOR_TREE_H